@@ -0,0 +1,980 @@
+/* Benchmarks for oso89. Build with `./tool build bench`, then run
+   `build/bench <name>...`, or `build/bench` for the list of names.
+
+   Each benchmark times the oso89 way of doing something against the simple
+   way it would be done without it, and prints both. */
+#if defined(__unix__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L /* for clock_gettime() */
+#endif
+#include "oso89.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+static unsigned long bench_state = 0x2545F491u;
+
+static size_t
+rnd(size_t n) {
+  bench_state ^= bench_state << 13;
+  bench_state ^= bench_state >> 7;
+  bench_state ^= bench_state << 17;
+  bench_state &= 0xFFFFFFFFu;
+  return n ? (size_t)(bench_state % n) : 0;
+}
+
+static double
+now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Keeps the compiler from throwing away results that aren't otherwise used. */
+static volatile size_t bench_sink;
+
+static void
+report(char const *what, double secs, double bytes) {
+  if (bytes > 0)
+    printf("  %-36s %9.3f ms %10.1f MB/s\n", what, secs * 1e3,
+           bytes / secs / 1e6);
+  else
+    printf("  %-36s %9.3f ms\n", what, secs * 1e3);
+}
+
+static void
+bench_rope(void) {
+  size_t const inserts = 100000, chunk = 32;
+  char ins[32];
+  oso_rope *r = NULL;
+  oso *flat = NULL;
+  size_t i;
+  double t;
+  memset(ins, 'x', sizeof ins);
+  printf("rope: %lu random inserts of %lu bytes, up to %.1f MB\n",
+         (unsigned long)inserts, (unsigned long)chunk,
+         (double)(inserts * chunk) / 1e6);
+  bench_state = 1;
+  t = now();
+  for (i = 0; i < inserts; i++)
+    osoropeinsert(&r, rnd(osoropelen(r) + 1), ins, chunk);
+  osoputrope(&flat, r);
+  report("osoropeinsert, then osoputrope", now() - t, 0);
+  bench_sink = osolen(flat);
+  osoropefree(r);
+  osowipe(&flat);
+  bench_state = 1;
+  t = now();
+  for (i = 0; i < inserts; i++)
+    osoinsert(&flat, rnd(osolen(flat) + 1), ins, chunk);
+  report("osoinsert on a flat oso", now() - t, 0);
+  bench_sink = osolen(flat);
+  osofree(flat);
+}
+
+/* Byte at a time, the way it's done without osoutf8valid(). */
+static int
+plain_utf8valid(unsigned char const *s, size_t len) {
+  size_t i = 0;
+  while (i < len) {
+    unsigned long cp;
+    size_t n, k;
+    if (s[i] < 0x80) {
+      i++;
+      continue;
+    }
+    if ((s[i] & 0xE0) == 0xC0) n = 1, cp = s[i] & 0x1Fu;
+    else if ((s[i] & 0xF0) == 0xE0) n = 2, cp = s[i] & 0x0Fu;
+    else if ((s[i] & 0xF8) == 0xF0) n = 3, cp = s[i] & 0x07u;
+    else return 0;
+    if (len - i <= n) return 0;
+    for (k = 1; k <= n; k++) {
+      if ((s[i + k] & 0xC0) != 0x80) return 0;
+      cp = cp << 6 | (s[i + k] & 0x3Fu);
+    }
+    if (cp < (n == 1 ? 0x80u : n == 2 ? 0x800u : 0x10000u)) return 0;
+    if (cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) return 0;
+    i += n + 1;
+  }
+  return 1;
+}
+
+/* Text that's mostly ASCII, with `percent` of its characters multibyte. */
+static void
+make_utf8(oso **p, size_t len, size_t percent) {
+  static char const *const multi[] = {"\xC3\xA9", "\xE2\x82\xAC",
+                                      "\xF0\x9F\x98\x80"};
+  osoclear(p);
+  while (osolen(*p) < len) {
+    if (rnd(100) < percent) osocat(p, multi[rnd(3)]);
+    else osocatchar(p, (char)(rnd(10) ? 'a' + rnd(26) : ' '));
+  }
+}
+
+static void
+bench_utf8(void) {
+  size_t const len = (size_t)64 << 20, reps = 8;
+  size_t const percents[] = {0, 10, 100};
+  oso *text = NULL, *dst = NULL;
+  size_t i, r, n;
+  double t;
+  for (i = 0; i < sizeof percents / sizeof percents[0]; i++) {
+    make_utf8(&text, len, percents[i]);
+    printf("utf8: %lu MB, %lu%% multibyte characters\n",
+           (unsigned long)(len >> 20), (unsigned long)percents[i]);
+    t = now();
+    for (r = n = 0; r < reps; r++)
+      n += (size_t)plain_utf8valid((unsigned char *)text, osolen(text));
+    report("validate byte at a time", now() - t, (double)(len * reps));
+    bench_sink = n;
+    t = now();
+    for (r = n = 0; r < reps; r++) n += (size_t)osoutf8valid(text);
+    report("osoutf8valid", now() - t, (double)(len * reps));
+    bench_sink = n;
+    t = now();
+    for (r = n = 0; r < reps; r++) n += osoutf8count(text);
+    report("osoutf8count", now() - t, (double)(len * reps));
+    bench_sink = n;
+    osoensurecap(&dst, osolen(text));
+    t = now();
+    for (r = 0; r < reps; r++) {
+      osoclear(&dst);
+      if (plain_utf8valid((unsigned char *)text, osolen(text)))
+        osocatlen(&dst, (char *)text, osolen(text));
+    }
+    report("validate byte at a time, osocatlen", now() - t,
+           (double)(len * reps));
+    t = now();
+    for (r = 0; r < reps; r++) {
+      osoclear(&dst);
+      osocatutf8len(&dst, (char *)text, osolen(text));
+    }
+    report("osocatutf8len", now() - t, (double)(len * reps));
+    bench_sink = osolen(dst);
+  }
+  osofree(text);
+  osofree(dst);
+}
+
+static char const *const header_names[] = {
+  "Accept", "Accept-Encoding", "Accept-Language", "Authorization",
+  "Cache-Control", "Connection", "Content-Length", "Content-Type", "Cookie",
+  "Host", "If-Modified-Since", "If-None-Match", "Origin", "Referer",
+  "Sec-Fetch-Dest", "Sec-Fetch-Mode", "Sec-Fetch-Site",
+  "Upgrade-Insecure-Requests", "User-Agent", "X-Forwarded-For",
+  "X-Forwarded-Proto", "X-Request-Id", "Access-Control-Request-Headers",
+  "Strict-Transport-Security"};
+
+static void
+plain_tolower(char *s, size_t len) {
+  size_t i;
+  for (i = 0; i < len; i++) s[i] = (char)tolower((unsigned char)s[i]);
+}
+
+static void
+bench_case(void) {
+  size_t const names = sizeof header_names / sizeof header_names[0];
+  size_t const count = 4096, reps = 512, big = (size_t)64 << 20;
+  oso *hdrs[4096], *text = NULL, *want = NULL;
+  size_t i, r, n, bytes = 0;
+  double t;
+  for (i = 0; i < count; i++) {
+    hdrs[i] = NULL;
+    osoput(&hdrs[i], header_names[rnd(names)]);
+    bytes += osolen(hdrs[i]);
+  }
+  printf("case: %lu header names, %.1f bytes each on average, %lu passes\n",
+         (unsigned long)count, (double)bytes / (double)count,
+         (unsigned long)reps);
+  t = now();
+  for (r = 0; r < reps; r++)
+    for (i = 0; i < count; i++)
+      plain_tolower((char *)hdrs[i], osolen(hdrs[i]));
+  report("tolower() loop", now() - t, (double)(bytes * reps));
+  t = now();
+  for (r = 0; r < reps; r++)
+    for (i = 0; i < count; i++) osotolower(hdrs[i]);
+  report("osotolower", now() - t, (double)(bytes * reps));
+  for (i = 0; i < count; i++)
+    if (rnd(2)) osotoupper(hdrs[i]);
+  osoput(&want, "x-forwarded-for");
+  t = now();
+  for (r = n = 0; r < reps; r++)
+    for (i = 0; i < count; i++)
+      n += !strcasecmp((char *)hdrs[i], (char *)want);
+  report("strcasecmp against one name", now() - t, (double)(bytes * reps));
+  bench_sink = n;
+  t = now();
+  for (r = n = 0; r < reps; r++)
+    for (i = 0; i < count; i++) n += (size_t)osocaseeq(hdrs[i], want);
+  report("osocaseeq against one name", now() - t, (double)(bytes * reps));
+  bench_sink = n;
+  t = now();
+  for (r = n = 0; r < reps; r++)
+    for (i = 1; i < count; i++)
+      n += !strcasecmp((char *)hdrs[i], (char *)hdrs[i - 1]);
+  report("strcasecmp neighbours", now() - t, (double)(bytes * reps));
+  bench_sink = n;
+  t = now();
+  for (r = n = 0; r < reps; r++)
+    for (i = 1; i < count; i++) n += (size_t)osocaseeq(hdrs[i], hdrs[i - 1]);
+  report("osocaseeq neighbours", now() - t, (double)(bytes * reps));
+  bench_sink = n;
+  for (i = 0; i < count; i++) osofree(hdrs[i]);
+  while (osolen(text) < big) osocat(&text, header_names[rnd(names)]);
+  printf("case: %lu MB of header names in one string\n",
+         (unsigned long)(big >> 20));
+  t = now();
+  plain_tolower((char *)text, osolen(text));
+  report("tolower() loop", now() - t, (double)osolen(text));
+  t = now();
+  osotoupper(text);
+  report("osotoupper", now() - t, (double)osolen(text));
+  osoputoso(&want, text);
+  osotolower(want);
+  t = now();
+  bench_sink = (size_t)strcasecmp((char *)text, (char *)want);
+  report("strcasecmp", now() - t, (double)osolen(text));
+  t = now();
+  bench_sink = (size_t)osocasecmp(text, want);
+  report("osocasecmp", now() - t, (double)osolen(text));
+  osofree(text);
+  osofree(want);
+}
+
+/* A chained hash map with strcmp(), the way it's done without oso_map. */
+struct chain_node {
+  struct chain_node *next;
+  char *key;
+  void *value;
+};
+
+struct chain_map {
+  struct chain_node **buckets;
+  size_t len, cap;
+};
+
+static size_t
+chain_hash(char const *s) {
+  size_t h = 2166136261u;
+  while (*s) h = (h ^ (unsigned char)*s++) * 16777619u;
+  return h;
+}
+
+static void **
+chain_set(struct chain_map *m, char const *key) {
+  struct chain_node *n;
+  size_t b;
+  if (m->len >= m->cap) {
+    size_t cap = m->cap ? m->cap * 2 : 16, i;
+    struct chain_node **buckets = calloc(cap, sizeof *buckets);
+    for (i = 0; i < m->cap; i++) {
+      while ((n = m->buckets[i])) {
+        m->buckets[i] = n->next;
+        b = chain_hash(n->key) & (cap - 1);
+        n->next = buckets[b];
+        buckets[b] = n;
+      }
+    }
+    free(m->buckets);
+    m->buckets = buckets;
+    m->cap = cap;
+  }
+  b = chain_hash(key) & (m->cap - 1);
+  for (n = m->buckets[b]; n; n = n->next)
+    if (!strcmp(n->key, key)) return &n->value;
+  n = malloc(sizeof *n);
+  n->key = malloc(strlen(key) + 1);
+  strcpy(n->key, key);
+  n->value = NULL;
+  n->next = m->buckets[b];
+  m->buckets[b] = n;
+  m->len++;
+  return &n->value;
+}
+
+static void **
+chain_get(struct chain_map const *m, char const *key) {
+  struct chain_node *n;
+  if (!m->cap) return NULL;
+  for (n = m->buckets[chain_hash(key) & (m->cap - 1)]; n; n = n->next)
+    if (!strcmp(n->key, key)) return &n->value;
+  return NULL;
+}
+
+static void
+chain_free(struct chain_map *m) {
+  size_t i;
+  for (i = 0; i < m->cap; i++) {
+    struct chain_node *n = m->buckets[i], *next;
+    for (; n; n = next) {
+      next = n->next;
+      free(n->key);
+      free(n);
+    }
+  }
+  free(m->buckets);
+}
+
+static void
+bench_map(void) {
+  size_t const count = 1 << 20;
+  oso **keys = malloc(count * sizeof *keys), **misses;
+  struct chain_map chain = {NULL, 0, 0};
+  oso_map *m = NULL;
+  size_t i, n;
+  double t;
+  if (!keys) return;
+  misses = malloc(count * sizeof *misses);
+  for (i = 0; i < count; i++) {
+    keys[i] = misses[i] = NULL;
+    osoputprintf(&keys[i], "session:%08lx:user", (unsigned long)rnd(~0u));
+    osoputprintf(&misses[i], "session:%08lx:gone", (unsigned long)rnd(~0u));
+  }
+  printf("map: %lu keys like \"%s\"\n", (unsigned long)count, (char *)keys[0]);
+  t = now();
+  for (i = 0; i < count; i++) *chain_set(&chain, (char *)keys[i]) = keys[i];
+  report("chained map, insert", now() - t, 0);
+  t = now();
+  for (i = n = 0; i < count; i++) n += chain_get(&chain, (char *)keys[i]) != 0;
+  report("chained map, find", now() - t, 0);
+  bench_sink = n;
+  t = now();
+  for (i = n = 0; i < count; i++)
+    n += chain_get(&chain, (char *)misses[i]) != 0;
+  report("chained map, miss", now() - t, 0);
+  bench_sink = n;
+  chain_free(&chain);
+  /* The map takes ownership of its keys, so it gets copies, which is what
+     the chained map does too. */
+  t = now();
+  for (i = 0; i < count; i++) {
+    oso *key = NULL;
+    osoputoso(&key, keys[i]);
+    *osomapset(&m, key) = keys[i];
+  }
+  report("oso_map, insert", now() - t, 0);
+  osomapfree(m);
+  m = NULL;
+  osomapreserve(&m, count);
+  t = now();
+  for (i = 0; i < count; i++) {
+    oso *key = NULL;
+    osoputoso(&key, keys[i]);
+    *osomapset(&m, key) = keys[i];
+  }
+  report("oso_map, insert after osomapreserve", now() - t, 0);
+  t = now();
+  for (i = n = 0; i < count; i++) n += osomapget(m, keys[i]) != 0;
+  report("oso_map, find", now() - t, 0);
+  bench_sink = n;
+  t = now();
+  for (i = n = 0; i < count; i++) n += osomapget(m, misses[i]) != 0;
+  report("oso_map, miss", now() - t, 0);
+  bench_sink = n;
+  osomapfree(m);
+  for (i = 0; i < count; i++) {
+    osofree(keys[i]);
+    osofree(misses[i]);
+  }
+  free(keys);
+  free(misses);
+}
+
+static int
+bench_strcmp(void const *a, void const *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void
+bench_sort(void) {
+  size_t const n = 1 << 20;
+  oso **arr = malloc(n * sizeof *arr), **copy = malloc(n * sizeof *copy);
+  size_t i;
+  double t;
+  if (!arr || !copy) return;
+  /* URL-like keys that share a long prefix, like a sorted index would have. */
+  for (i = 0; i < n; i++) {
+    arr[i] = NULL;
+    osoputprintf(&arr[i], "https://example.com/api/v2/users/%08lx/%lu",
+                 (unsigned long)rnd(1ul << 30), (unsigned long)rnd(100));
+  }
+  printf("sort: %lu URL-like strings\n", (unsigned long)n);
+  memcpy(copy, arr, n * sizeof *arr);
+  t = now();
+  qsort(copy, n, sizeof *copy, bench_strcmp);
+  report("qsort with strcmp", now() - t, 0);
+  memcpy(copy, arr, n * sizeof *arr);
+  t = now();
+  ososort(copy, n);
+  report("ososort", now() - t, 0);
+  for (i = 0; i < n; i++) osofree(arr[i]);
+  free(arr);
+  free(copy);
+}
+
+static void
+bench_parse(void) {
+  size_t const rows = (size_t)1 << 20, reps = 4;
+  oso *csv = NULL;
+  char const *p, *end;
+  size_t i, r;
+  double t, sum, ref_sum;
+  oso_i64 isum, ref_isum;
+  /* A numeric CSV: an id, a count that's often small, and two prices. */
+  for (i = 0; i < rows; i++)
+    osocatprintf(&csv, "%lu,%ld,%lu.%02lu,%.6g\n", (unsigned long)(i + 1000000),
+                 (long)rnd(2000) - 1000, (unsigned long)rnd(100000),
+                 (unsigned long)rnd(100), (double)rnd(1000000) / 7.0);
+  printf("parse: %lu CSV rows of 2 integers and 2 floats, %.1f MB, %lu "
+         "passes\n", (unsigned long)rows, (double)osolen(csv) / 1e6,
+         (unsigned long)reps);
+  end = (char *)csv + osolen(csv);
+  t = now();
+  for (r = 0, sum = 0, isum = 0; r < reps; r++) {
+    for (p = (char *)csv; p < end;) {
+      char *next;
+      isum += strtoll(p, &next, 10);
+      isum += strtoll(next + 1, &next, 10);
+      sum += strtod(next + 1, &next);
+      sum += strtod(next + 1, &next);
+      p = next + 1;
+    }
+  }
+  report("strtoll and strtod", now() - t, (double)(osolen(csv) * reps));
+  ref_isum = isum;
+  ref_sum = sum;
+  t = now();
+  for (r = 0, sum = 0, isum = 0; r < reps; r++) {
+    for (p = (char *)csv; p < end;) {
+      size_t used;
+      oso_i64 v;
+      double d;
+      osotoi64(p, (size_t)(end - p), &v, &used);
+      isum += v;
+      p += used + 1;
+      osotoi64(p, (size_t)(end - p), &v, &used);
+      isum += v;
+      p += used + 1;
+      osotodouble(p, (size_t)(end - p), &d, &used);
+      sum += d;
+      p += used + 1;
+      osotodouble(p, (size_t)(end - p), &d, &used);
+      sum += d;
+      p += used + 1;
+    }
+  }
+  report("osotoi64 and osotodouble", now() - t, (double)(osolen(csv) * reps));
+  if (isum != ref_isum || sum != ref_sum) puts("  WRONG: the sums differ");
+  osofree(csv);
+}
+
+static void
+bench_double(void) {
+  size_t const n = (size_t)1 << 20;
+  double *vals = malloc(n * sizeof(double));
+  oso *out = NULL;
+  size_t i;
+  double t;
+  if (!vals) return;
+  /* Half "nice" decimals like prices, half random bit patterns that need
+     all 17 digits. */
+  for (i = 0; i < n; i++) {
+    if (i % 2) {
+      vals[i] = (double)rnd(1000000) / 100.0;
+    } else {
+      oso_u64 bits = (oso_u64)rnd(1ul << 31) << 32 | (oso_u64)rnd(1ul << 31);
+      bits &= ~((oso_u64)0x7FF << 52);
+      bits |= (oso_u64)(900 + rnd(248)) << 52;
+      memcpy(&vals[i], &bits, sizeof(double));
+    }
+  }
+  printf("double: %lu doubles, half short decimals and half full precision\n",
+         (unsigned long)n);
+  osoensurecap(&out, n * 25);
+  t = now();
+  for (i = 0; i < n; i++) {
+    osocatprintf(&out, "%.17g", vals[i]);
+    osocatchar(&out, ',');
+  }
+  report("osocatprintf %.17g", now() - t, 0);
+  printf("  %-36s %9.1f bytes\n", "average output",
+         (double)osolen(out) / (double)n);
+  osoclear(&out);
+  t = now();
+  for (i = 0; i < n; i++) {
+    osocatdouble(&out, vals[i]);
+    osocatchar(&out, ',');
+  }
+  report("osocatdouble", now() - t, 0);
+  printf("  %-36s %9.1f bytes\n", "average output",
+         (double)osolen(out) / (double)n);
+  osofree(out);
+  free(vals);
+}
+
+static void
+bench_char(void) {
+  static char const *const names[][2] = {
+    {"osocatlen(&c, 1), from empty", "osocatchar, from empty"},
+    {"osocatlen(&c, 1), reserved", "osocatchar, reserved"}};
+  size_t const n = (size_t)1 << 26, runs = (size_t)1 << 20;
+  oso *s = NULL;
+  size_t i, pass;
+  double t;
+  char c;
+  printf("char: %lu single-char appends, then %lu runs of 0-15 chars\n",
+         (unsigned long)n, (unsigned long)runs);
+  /* First from an empty string, so the growth is timed too, then into one
+     reserved up front, which only times the path that doesn't grow. */
+  for (pass = 0; pass < 2; pass++) {
+    osofree(s);
+    s = NULL;
+    if (pass) osoensurecap(&s, n);
+    t = now();
+    for (i = 0; i < n; i++) {
+      c = (char)('a' + (i & 15));
+      osocatlen(&s, &c, 1);
+    }
+    t = now() - t;
+    report(names[pass][0], t, 0);
+    printf("  %-36s %9.2f ns\n", "per char", t * 1e9 / (double)n);
+    bench_sink = osolen(s);
+    osofree(s);
+    s = NULL;
+    if (pass) osoensurecap(&s, n);
+    t = now();
+    for (i = 0; i < n; i++) osocatchar(&s, (char)('a' + (i & 15)));
+    t = now() - t;
+    report(names[pass][1], t, 0);
+    printf("  %-36s %9.2f ns\n", "per char", t * 1e9 / (double)n);
+    bench_sink = osolen(s);
+  }
+  osofree(s);
+  s = NULL;
+  t = now();
+  for (i = 0; i < runs; i++) osofill(&s, ' ', i & 15);
+  report("osofill, from empty", now() - t, 0);
+  bench_sink = osolen(s);
+  osofree(s);
+  s = NULL;
+  t = now();
+  for (i = 0; i < runs; i++) osocatchars(&s, ' ', i & 15);
+  report("osocatchars, from empty", now() - t, 0);
+  bench_sink = osolen(s);
+  osofree(s);
+}
+
+/* The byte-at-a-time JSON escaper that osocatjsonesc() replaces. */
+static void
+plain_jsonesc(oso **p, char const *src, size_t len) {
+  static char const hex[] = "0123456789abcdef";
+  size_t i;
+  for (i = 0; i < len; i++) {
+    unsigned char c = (unsigned char)src[i];
+    char esc[6] = {'\\', 'u', '0', '0', 0, 0};
+    switch (c) {
+    case '"': osocatlen(p, "\\\"", 2); break;
+    case '\\': osocatlen(p, "\\\\", 2); break;
+    case '\n': osocatlen(p, "\\n", 2); break;
+    case '\r': osocatlen(p, "\\r", 2); break;
+    case '\t': osocatlen(p, "\\t", 2); break;
+    default:
+      if (c < 0x20) {
+        esc[4] = hex[c >> 4];
+        esc[5] = hex[c & 15];
+        osocatlen(p, esc, 6);
+      } else {
+        osocatlen(p, (char const *)&c, 1);
+      }
+    }
+  }
+}
+
+static void
+bench_escape(void) {
+  size_t const fields = 1 << 16, reps = 16;
+  oso **text = malloc(fields * sizeof *text), *out = NULL;
+  size_t i, r, bytes = 0;
+  double t;
+  if (!text) return;
+  /* Log-message-like fields: mostly plain, with a quote or a newline now
+     and then. */
+  for (i = 0; i < fields; i++) {
+    size_t len = 20 + rnd(200), k;
+    text[i] = NULL;
+    for (k = 0; k < len; k++) {
+      size_t x = rnd(200);
+      osocatchar(&text[i], x == 0 ? '"' : x == 1 ? '\n' : x == 2 ? '<'
+                           : x < 30 ? ' ' : (char)('a' + x % 26));
+    }
+    bytes += len;
+  }
+  printf("escape: %lu fields, %.0f bytes each on average, %lu passes\n",
+         (unsigned long)fields, (double)bytes / (double)fields,
+         (unsigned long)reps);
+  osoensurecap(&out, bytes * 2);
+  t = now();
+  for (r = 0; r < reps; r++) {
+    osoclear(&out);
+    for (i = 0; i < fields; i++)
+      plain_jsonesc(&out, (char *)text[i], osolen(text[i]));
+  }
+  report("JSON, byte at a time", now() - t, (double)(bytes * reps));
+  t = now();
+  for (r = 0; r < reps; r++) {
+    osoclear(&out);
+    for (i = 0; i < fields; i++)
+      osocatjsonesc(&out, (char *)text[i], osolen(text[i]));
+  }
+  report("osocatjsonesc", now() - t, (double)(bytes * reps));
+  t = now();
+  for (r = 0; r < reps; r++) {
+    osoclear(&out);
+    for (i = 0; i < fields; i++)
+      osocathtmlesc(&out, (char *)text[i], osolen(text[i]));
+  }
+  report("osocathtmlesc", now() - t, (double)(bytes * reps));
+  t = now();
+  for (r = 0; r < reps; r++) {
+    osoclear(&out);
+    for (i = 0; i < fields; i++)
+      osocatcesc(&out, (char *)text[i], osolen(text[i]));
+  }
+  report("osocatcesc", now() - t, (double)(bytes * reps));
+  t = now();
+  for (r = 0; r < reps; r++) {
+    osoclear(&out);
+    for (i = 0; i < fields; i++)
+      osocaturlenc(&out, (char *)text[i], osolen(text[i]));
+  }
+  report("osocaturlenc", now() - t, (double)(bytes * reps));
+  bench_sink = osolen(out);
+  for (i = 0; i < fields; i++) osofree(text[i]);
+  free(text);
+  osofree(out);
+}
+
+static void
+bench_copy(void) {
+  size_t const len = (size_t)1 << 30, reps = 4;
+  char *src = malloc(len), *dst = malloc(len);
+  oso *s = NULL;
+  size_t r;
+  double t;
+  if (!src || !dst || !osoensurecap(&s, len)) return;
+  /* Touch everything first, so page faults aren't timed. */
+  memset(src, 'x', len);
+  memset(dst, 0, len);
+  osofill(&s, 0, len);
+  printf("copy: %lu MB, %lu passes\n", (unsigned long)(len >> 20),
+         (unsigned long)reps);
+  t = now();
+  for (r = 0; r < reps; r++) {
+    memcpy(dst, src, len);
+    bench_sink = (size_t)dst[r];
+  }
+  report("memcpy", now() - t, (double)(len * reps));
+  t = now();
+  for (r = 0; r < reps; r++) osoputlen(&s, src, len);
+  report("osoputlen", now() - t, (double)(len * reps));
+  t = now();
+  for (r = 0; r < reps; r++) {
+    memset(dst, (int)r, len);
+    bench_sink = (size_t)dst[r];
+  }
+  report("memset", now() - t, (double)(len * reps));
+  t = now();
+  for (r = 0; r < reps; r++) {
+    osoclear(&s);
+    osofill(&s, (char)r, len);
+  }
+  report("osofill", now() - t, (double)(len * reps));
+  free(src);
+  free(dst);
+  osofree(s);
+}
+
+static void
+bench_grow(void) {
+  size_t const chunk = (size_t)1 << 16;
+  char const *env = getenv("BENCH_GROW_MB");
+  size_t const len = (env ? (size_t)strtoul(env, NULL, 10) : 1024) << 20;
+  char *src = malloc(chunk), *plain = NULL;
+  size_t used, cap = 0;
+  oso *s = NULL;
+  double t;
+  if (!src) return;
+  memset(src, 'x', chunk);
+  printf("grow: one string to %lu MB in %lu KB appends (set BENCH_GROW_MB to "
+         "change)\n", (unsigned long)(len >> 20), (unsigned long)(chunk >> 10));
+#if defined(OSO_MMAP_THRESHOLD)
+  printf("  built with OSO_MMAP_THRESHOLD=%lu\n",
+         (unsigned long)(OSO_MMAP_THRESHOLD));
+#else
+  puts("  built without OSO_MMAP_THRESHOLD, so oso grows with realloc()");
+#endif
+  t = now();
+  for (used = 0; used < len; used += chunk) {
+    if (used + chunk + 1 > cap) {
+      char *p;
+      cap = cap ? cap * 2 : chunk * 2;
+      p = realloc(plain, cap);
+      if (!p) break;
+      plain = p;
+    }
+    memcpy(plain + used, src, chunk);
+  }
+  report("realloc doubling", now() - t, (double)used);
+  bench_sink = (size_t)plain[used - 1];
+  free(plain);
+  /* osocatlen() doubles the capacity too, so both loops grow the same number
+     of times, and only how they grow differs. */
+  t = now();
+  for (used = 0; used < len; used += chunk)
+    if (!osocatlen(&s, src, chunk)) break;
+  report("osocatlen", now() - t, (double)used);
+  bench_sink = osolen(s);
+  osofree(s);
+  free(src);
+}
+
+#if defined(OSO_THREADS)
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/* Every this many lines, a producer times one call. */
+#define BENCH_LOG_SAMPLE 16
+
+struct bench_logger {
+  int use_queue;
+  size_t lines;
+  oso_logq *q;
+  /* The mutex-per-line logger that the queue replaces. */
+  pthread_mutex_t lock;
+  oso *shared;
+  int fd;
+};
+
+static void
+bench_logline(struct bench_logger *l, size_t i) {
+  if (l->use_queue) {
+    osolog(l->q, "request %lu took %lu us, status %d\n", (unsigned long)i,
+           (unsigned long)(i * 7 % 1000), 200);
+    return;
+  }
+  pthread_mutex_lock(&l->lock);
+  osocatprintf(&l->shared, "request %lu took %lu us, status %d\n",
+               (unsigned long)i, (unsigned long)(i * 7 % 1000), 200);
+  if (osolen(l->shared) >= (size_t)1 << 16) {
+    bench_sink += (size_t)write(l->fd, l->shared, osolen(l->shared));
+    osoclear(&l->shared);
+  }
+  pthread_mutex_unlock(&l->lock);
+}
+
+struct bench_producer {
+  struct bench_logger *l;
+  double *samples;
+};
+
+static void *
+bench_logproducer(void *arg) {
+  struct bench_producer *p = (struct bench_producer *)arg;
+  size_t i, k = 0;
+  for (i = 0; i < p->l->lines; i++) {
+    if (i % BENCH_LOG_SAMPLE) {
+      bench_logline(p->l, i);
+    } else {
+      double t = now();
+      bench_logline(p->l, i);
+      p->samples[k++] = now() - t;
+    }
+  }
+  if (p->l->use_queue) osologflush();
+  return NULL;
+}
+
+static int
+bench_cmpdouble(void const *a, void const *b) {
+  double x = *(double const *)a, y = *(double const *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void
+bench_log(void) {
+  size_t const total = (size_t)1 << 21;
+  static size_t const counts[] = {1, 2, 4, 8, 16, 32};
+  int fd = open("/dev/null", O_WRONLY);
+  size_t c, i;
+  if (fd < 0) return;
+  printf("log: %lu lines of about 40 bytes to /dev/null, split across the "
+         "threads\n", (unsigned long)total);
+  printf("  %-7s %-6s %10s %10s %10s %10s\n", "threads", "how", "Mlines/s",
+         "p50 ns", "p99 ns", "max ns");
+  for (c = 0; c < sizeof counts / sizeof counts[0]; c++) {
+    size_t const n = counts[c], per = total / n;
+    size_t const sampled = (per + BENCH_LOG_SAMPLE - 1) / BENCH_LOG_SAMPLE;
+    pthread_t threads[32];
+    struct bench_producer prod[32];
+    double *samples = malloc(n * sampled * sizeof(double));
+    int use_queue;
+    if (!samples) break;
+    for (use_queue = 0; use_queue < 2; use_queue++) {
+      struct bench_logger l;
+      oso_logq q;
+      double t;
+      l.use_queue = use_queue;
+      l.lines = per;
+      l.q = &q;
+      l.shared = NULL;
+      l.fd = fd;
+      pthread_mutex_init(&l.lock, NULL);
+      osologqinit(&q);
+      t = now();
+      if (use_queue) osologqstart(&q, fd);
+      for (i = 0; i < n; i++) {
+        prod[i].l = &l;
+        prod[i].samples = samples + i * sampled;
+        pthread_create(&threads[i], NULL, bench_logproducer, &prod[i]);
+      }
+      for (i = 0; i < n; i++) pthread_join(threads[i], NULL);
+      if (use_queue) {
+        osologqstop(&q);
+      } else {
+        bench_sink += (size_t)write(fd, l.shared, osolen(l.shared));
+      }
+      t = now() - t;
+      qsort(samples, n * sampled, sizeof(double), bench_cmpdouble);
+      printf("  %-7lu %-6s %10.2f %10.0f %10.0f %10.0f\n", (unsigned long)n,
+             use_queue ? "osolog" : "mutex", (double)(per * n) / t / 1e6,
+             samples[n * sampled / 2] * 1e9,
+             samples[n * sampled * 99 / 100] * 1e9,
+             samples[n * sampled - 1] * 1e9);
+      pthread_mutex_destroy(&l.lock);
+      osofree(l.shared);
+    }
+    free(samples);
+  }
+  close(fd);
+}
+
+struct bench_shardjob {
+  oso **shards;
+  size_t records, parts, part;
+};
+
+static void *
+bench_buildshard(void *arg) {
+  struct bench_shardjob const *job = (struct bench_shardjob const *)arg;
+  size_t begin, end, i;
+  oso **shard = &job->shards[job->part];
+  osopartrange(job->records, job->parts, job->part, &begin, &end);
+  for (i = begin; i < end; i++)
+    osocatprintf(shard, "%lu,user%lu,%lu.%02lu\n", (unsigned long)i,
+                 (unsigned long)(i * 31 % 100000),
+                 (unsigned long)(i % 5000), (unsigned long)(i % 100));
+  return NULL;
+}
+
+static void
+bench_concat(void) {
+  size_t const records = (size_t)1 << 22;
+  static size_t const counts[] = {1, 2, 4, 8, 16, 32, 64};
+  oso *shards[64], *out = NULL, *ref = NULL;
+  size_t c, i;
+  printf("concat: %lu CSV records built in shards by 1-64 threads, then "
+         "osoconcat\n  (pool of %d threads for the concat)\n",
+         (unsigned long)records, (int)(OSO_THREADS));
+  for (i = 0; i < records; i++)
+    osocatprintf(&ref, "%lu,user%lu,%lu.%02lu\n", (unsigned long)i,
+                 (unsigned long)(i * 31 % 100000),
+                 (unsigned long)(i % 5000), (unsigned long)(i % 100));
+  for (c = 0; c < sizeof counts / sizeof counts[0]; c++) {
+    size_t const n = counts[c];
+    pthread_t threads[64];
+    struct bench_shardjob jobs[64];
+    double t0 = now(), t1, t2;
+    for (i = 0; i < n; i++) {
+      shards[i] = NULL;
+      jobs[i].shards = shards;
+      jobs[i].records = records;
+      jobs[i].parts = n;
+      jobs[i].part = i;
+      pthread_create(&threads[i], NULL, bench_buildshard, &jobs[i]);
+    }
+    for (i = 0; i < n; i++) pthread_join(threads[i], NULL);
+    t1 = now();
+    osoclear(&out);
+    osoconcat(&out, (oso const *const *)shards, n);
+    t2 = now();
+    printf("  %2lu threads: build %9.3f ms, concat %7.3f ms (%.0f MB/s)%s\n",
+           (unsigned long)n, (t1 - t0) * 1e3, (t2 - t1) * 1e3,
+           (double)osolen(out) / (t2 - t1) / 1e6,
+           osoeq(out, ref) ? "" : "  WRONG");
+    for (i = 0; i < n; i++) osofree(shards[i]);
+  }
+  osofree(out);
+  osofree(ref);
+}
+#undef BENCH_LOG_SAMPLE
+#else
+static void
+bench_log(void) {
+  puts("log: needs threads, build with ./tool build -D OSO_THREADS=1 bench");
+}
+
+static void
+bench_concat(void) {
+  puts("concat: needs threads, build with ./tool build -D OSO_THREADS=4 bench");
+}
+#endif
+
+static struct {
+  char const *name;
+  void (*fn)(void);
+} const benches[] = {
+  {"rope", bench_rope},
+  {"utf8", bench_utf8},
+  {"case", bench_case},
+  {"map", bench_map},
+  {"sort", bench_sort},
+  {"escape", bench_escape},
+  {"copy", bench_copy},
+  {"parse", bench_parse},
+  {"double", bench_double},
+  {"char", bench_char},
+  {"grow", bench_grow},
+  {"log", bench_log},
+  {"concat", bench_concat},
+};
+
+int
+main(int argc, char **argv) {
+  size_t const count = sizeof benches / sizeof benches[0];
+  size_t i;
+  int arg;
+  if (argc < 2) {
+    fputs("Usage: bench <name>...\nNames:", stderr);
+    for (i = 0; i < count; i++) fprintf(stderr, " %s", benches[i].name);
+    fputs(" all\n", stderr);
+    return 1;
+  }
+  for (arg = 1; arg < argc; arg++) {
+    int found = 0;
+    for (i = 0; i < count; i++) {
+      if (strcmp(argv[arg], "all") && strcmp(argv[arg], benches[i].name))
+        continue;
+      benches[i].fn();
+      found = 1;
+    }
+    if (!found) {
+      fprintf(stderr, "Unknown benchmark '%s'\n", argv[arg]);
+      return 1;
+    }
+  }
+  return 0;
+}
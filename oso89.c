@@ -1,7 +1,28 @@
+#if defined(OSO_MMAP_THRESHOLD) && defined(__linux__)
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for mremap() */
+#endif
+#include <sys/mman.h>
+#define OSO_MMAP
+#endif
+
 #include "oso89.h"
+#include <float.h>
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L
+#include <stdint.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define OSO_POSIX
+#endif
 
 #if (defined(__GNUC__) || defined(__clang__)) && defined(__has_attribute)
 #if __has_attribute(noinline) && __has_attribute(noclone)
@@ -19,9 +40,36 @@
 #define OSO_NOINLINE
 #endif
 
+#if !defined(OSO_NO_SIMD)
+#if defined(__SSE2__) || defined(_M_X64) || \
+  (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OSO_SSE2
+#endif
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#define OSO_SSSE3
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define OSO_AVX2
+#endif
+#endif
+
 #define OSO_INTERNAL OSO_NOINLINE static
 #define OSO_HDR(s) ((oso_header *)s - 1)
-#define OSO_CAP_MAX ((size_t)(-1) - (sizeof(oso_header) + 1))
+/* The top bit of `cap` is set for an oso that lives in memory provided by the
+   caller (see `osoinitbuf()`.) That memory must never be passed to realloc()
+   or free(). The next bit is set for an oso that lives in its own anonymous
+   mapping, which is grown with mremap() and released with munmap(). The third
+   bit is set while the cached hash is valid. These have to match the
+   `OSO_IMPL_*` macros in oso89.h, which the inline appenders use. */
+#define OSO_FLAG_INLINE ((size_t)1 << (sizeof(size_t) * 8 - 1))
+#define OSO_FLAG_MAPPED ((size_t)1 << (sizeof(size_t) * 8 - 2))
+#define OSO_FLAG_HASHED ((size_t)1 << (sizeof(size_t) * 8 - 3))
+#define OSO_CAPOF(hdr) \
+  ((hdr)->cap & ~(OSO_FLAG_INLINE | OSO_FLAG_MAPPED | OSO_FLAG_HASHED))
+#define OSO_CAP_MAX (((size_t)(-1) >> 3) - (sizeof(oso_header) + 1))
 
 #define STB_SPRINTF_DECORATE(name) oso_implsp_##name
 
@@ -42,10 +90,13 @@
 #define STB_SPRINTF_IMPLEMENTATION
 #define STB_SPRINTF_STATIC
 #define STB_SPRINTF_NOUNALIGNED
+/* `%S` takes an oso. */
+#define STB_SPRINTF_LENGTH_OF(s) osolen((oso const *)(s))
 #include <stb_sprintf.h>
 #undef STB_SPRINTF_IMPLEMENTATION
 #undef STB_SPRINTF_STATIC
 #undef STB_SPRINTF_NOUNALIGNED
+#undef STB_SPRINTF_LENGTH_OF
 
 #if defined(__GNUC__)
 #pragma GCC diagnostic pop
@@ -59,17 +110,317 @@
 #undef OSO_NOSAN_AVAIL
 #endif
 
+/* `len` and `cap` come last, so that they sit right before the string data
+   whatever the build options are. The inline appenders in oso89.h rely on
+   this. */
 typedef struct oso {
+#if defined(OSO_CACHE_HASH)
+  oso_u64 hash; /* only valid if `cap` has OSO_FLAG_HASHED */
+#endif
   size_t len, cap;
 } oso_header;
 
+/* Every function that changes the contents or length of a string must call
+   this, so that a cached hash doesn't go stale. */
+#if defined(OSO_CACHE_HASH)
+#define OSO_DIRTY(hdr) ((hdr)->cap &= ~OSO_FLAG_HASHED)
+#else
+#define OSO_DIRTY(hdr) ((void)0)
+#endif
+
+/* Builds a 64-bit constant from two 32-bit halves, since C89 has no 64-bit
+   literals. */
+#define OSO_U64(hi, lo) ((oso_u64)(hi) << 32 | (oso_u64)(lo))
+
+/* Loads 8 bytes as a little-endian number, whatever the byte order of the
+   machine. */
+static oso_u64
+oso_impl_load8(unsigned char const *s) {
+  return (oso_u64)s[0] | (oso_u64)s[1] << 8 | (oso_u64)s[2] << 16 |
+         (oso_u64)s[3] << 24 | (oso_u64)s[4] << 32 | (oso_u64)s[5] << 40 |
+         (oso_u64)s[6] << 48 | (oso_u64)s[7] << 56;
+}
+
+/* With OSO_THREADS defined to a number of threads, some big jobs are split
+   into parts that run on a small pool of threads. The pool has OSO_THREADS - 1
+   threads, since the calling thread works on the job too. They're started the
+   first time they're needed and then wait for work for the life of the
+   process. Only one job runs on the pool at a time. A job that comes along
+   while the pool is busy, including one started from inside a job, just runs
+   on the calling thread. */
+#if defined(OSO_THREADS) && defined(OSO_POSIX)
+#include <pthread.h>
+#define OSO_POOL
+
+static pthread_mutex_t oso_impl_poollock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t oso_impl_poolwork = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t oso_impl_pooldone = PTHREAD_COND_INITIALIZER;
+static void (*oso_impl_poolfn)(void *arg, size_t part, size_t parts);
+static void *oso_impl_poolarg;
+static size_t oso_impl_poolparts, oso_impl_poolnext, oso_impl_poolfinished;
+static int oso_impl_poolbusy, oso_impl_poolstarted;
+
+/* Takes parts of the current job until there are none left. Called and
+   returns with the lock held. */
+static void
+oso_impl_poolhelp(void) {
+  while (oso_impl_poolfn && oso_impl_poolnext < oso_impl_poolparts) {
+    void (*fn)(void *, size_t, size_t) = oso_impl_poolfn;
+    void *arg = oso_impl_poolarg;
+    size_t part = oso_impl_poolnext++, parts = oso_impl_poolparts;
+    pthread_mutex_unlock(&oso_impl_poollock);
+    fn(arg, part, parts);
+    pthread_mutex_lock(&oso_impl_poollock);
+    if (++oso_impl_poolfinished == parts)
+      pthread_cond_signal(&oso_impl_pooldone);
+  }
+}
+
+static void *
+oso_impl_poolmain(void *unused) {
+  (void)unused;
+  pthread_mutex_lock(&oso_impl_poollock);
+  for (;;) {
+    oso_impl_poolhelp();
+    pthread_cond_wait(&oso_impl_poolwork, &oso_impl_poollock);
+  }
+  return NULL;
+}
+
+/* Starts the threads, if they haven't been. Called with the lock held. If
+   some can't be started, the job is shared among the ones that could. */
+static void
+oso_impl_poolstart(void) {
+  int i;
+  if (oso_impl_poolstarted) return;
+  oso_impl_poolstarted = 1;
+  for (i = 1; i < (OSO_THREADS); i++) {
+    pthread_t t;
+    pthread_attr_t attr;
+    if (pthread_attr_init(&attr)) break;
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&t, &attr, oso_impl_poolmain, NULL)) i = OSO_THREADS;
+    pthread_attr_destroy(&attr);
+  }
+}
+#endif
+
+/* Calls `fn(arg, part, parts)` once for each part from 0 to `parts - 1`,
+   spread across the thread pool if there is one, and returns when they've
+   all finished. */
+OSO_INTERNAL void
+oso_impl_parallel(void (*fn)(void *arg, size_t part, size_t parts), void *arg,
+                  size_t parts) {
+  size_t i;
+#if defined(OSO_POOL)
+  pthread_mutex_lock(&oso_impl_poollock);
+  if (!oso_impl_poolbusy) {
+    oso_impl_poolstart();
+    oso_impl_poolbusy = 1;
+    oso_impl_poolfn = fn;
+    oso_impl_poolarg = arg;
+    oso_impl_poolparts = parts;
+    oso_impl_poolnext = oso_impl_poolfinished = 0;
+    pthread_cond_broadcast(&oso_impl_poolwork);
+    oso_impl_poolhelp();
+    while (oso_impl_poolfinished < parts)
+      pthread_cond_wait(&oso_impl_pooldone, &oso_impl_poollock);
+    oso_impl_poolfn = NULL;
+    oso_impl_poolbusy = 0;
+    pthread_mutex_unlock(&oso_impl_poollock);
+    return;
+  }
+  pthread_mutex_unlock(&oso_impl_poollock);
+#endif
+  for (i = 0; i < parts; i++) fn(arg, i, parts);
+}
+
+/* How many parts to split a job into, for `oso_impl_parallel()`. */
+#if defined(OSO_POOL)
+#define OSO_POOL_PARTS ((size_t)(OSO_THREADS))
+#else
+#define OSO_POOL_PARTS ((size_t)1)
+#endif
+
+/* Copies, fills and concatenations of this many bytes or more are split
+   across the thread pool, when there is one. */
+#ifndef OSO_PARALLEL_THRESHOLD
+#define OSO_PARALLEL_THRESHOLD ((size_t)1 << 24)
+#endif
+
+/* Fills this many bytes or more with non-temporal stores, which go around the
+   cache. A fill that big would evict everything else from the cache, and the
+   destination usually isn't read again soon. Big copies are left to memcpy(),
+   since glibc's already streams them, and measured faster than this loop. */
+#ifndef OSO_STREAM_THRESHOLD
+#define OSO_STREAM_THRESHOLD ((size_t)1 << 22)
+#endif
+
+#if defined(OSO_SSE2)
+OSO_INTERNAL void
+oso_impl_stream(char *dst, int c, size_t len) {
+  __m128i const fill = _mm_set1_epi8((char)c);
+  size_t head = (16 - ((size_t)dst & 15)) & 15, i;
+  memset(dst, c, head);
+  for (i = head; len - i >= 64; i += 64) {
+    _mm_stream_si128((__m128i *)(dst + i), fill);
+    _mm_stream_si128((__m128i *)(dst + i + 16), fill);
+    _mm_stream_si128((__m128i *)(dst + i + 32), fill);
+    _mm_stream_si128((__m128i *)(dst + i + 48), fill);
+  }
+  _mm_sfence();
+  memset(dst + i, c, len - i);
+}
+#endif
+
+/* Copies from `src`, or fills with `c` if `src` is null. */
+static void
+oso_impl_copyfill(char *dst, char const *src, int c, size_t len) {
+  if (src) {
+    memcpy(dst, src, len);
+    return;
+  }
+#if defined(OSO_SSE2)
+  if (len >= OSO_STREAM_THRESHOLD) {
+    oso_impl_stream(dst, c, len);
+    return;
+  }
+#endif
+  memset(dst, c, len);
+}
+
+struct oso_copyjob {
+  char *dst;
+  char const *src;
+  int c;
+  size_t len;
+};
+
+/* Part boundaries are multiples of 64, so no two threads write to the same
+   cache line. */
+static void
+oso_impl_copypart(void *arg, size_t part, size_t parts) {
+  struct oso_copyjob const *job = (struct oso_copyjob const *)arg;
+  size_t chunk = (job->len / parts + 63) & ~(size_t)63;
+  size_t begin = chunk * part, end = begin + chunk;
+  if (begin >= job->len) return;
+  if (end > job->len || part == parts - 1) end = job->len;
+  oso_impl_copyfill(job->dst + begin, job->src ? job->src + begin : NULL,
+                    job->c, end - begin);
+}
+
+/* memcpy(), but big copies are split across the thread pool. */
+static void
+oso_impl_copy(char *dst, char const *src, size_t len) {
+  if (OSO_POOL_PARTS > 1 && len >= OSO_PARALLEL_THRESHOLD) {
+    struct oso_copyjob job;
+    job.dst = dst;
+    job.src = src;
+    job.c = 0;
+    job.len = len;
+    oso_impl_parallel(oso_impl_copypart, &job, OSO_POOL_PARTS);
+    return;
+  }
+  oso_impl_copyfill(dst, src, 0, len);
+}
+
+/* memset(), but big fills are split across the thread pool, and go through
+   `oso_impl_stream()`. */
+static void
+oso_impl_fill(char *dst, int c, size_t len) {
+  if (OSO_POOL_PARTS > 1 && len >= OSO_PARALLEL_THRESHOLD) {
+    struct oso_copyjob job;
+    job.dst = dst;
+    job.src = NULL;
+    job.c = c;
+    job.len = len;
+    oso_impl_parallel(oso_impl_copypart, &job, OSO_POOL_PARTS);
+    return;
+  }
+  oso_impl_copyfill(dst, NULL, c, len);
+}
+
+static void
+oso_impl_freehdr(oso_header *hdr) {
+#if defined(OSO_MMAP)
+  if (hdr->cap & OSO_FLAG_MAPPED) {
+    munmap(hdr, sizeof(oso_header) + OSO_CAPOF(hdr) + 1);
+    return;
+  }
+#endif
+  if (!(hdr->cap & OSO_FLAG_INLINE)) free(hdr);
+}
+
+#if defined(OSO_MMAP)
+/* Moves a string into its own page-aligned mapping, or grows the mapping it's
+   already in. Growing with mremap() lets the kernel move the pages instead of
+   copying them. The capacity is rounded up to fill the last page. Returns null
+   if the allocation failed, without unmapping or freeing `hdr`. */
+OSO_INTERNAL oso *
+oso_impl_mapgrow(oso_header *hdr, size_t new_cap) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t bytes = sizeof(oso_header) + new_cap + 1;
+  void *m;
+  bytes = (bytes + page - 1) & ~(page - 1);
+  if (hdr && (hdr->cap & OSO_FLAG_MAPPED)) {
+    m = mremap(hdr, sizeof(oso_header) + OSO_CAPOF(hdr) + 1, bytes,
+               MREMAP_MAYMOVE);
+    if (m == MAP_FAILED) return NULL;
+  } else {
+    m = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+             -1, 0);
+    if (m == MAP_FAILED) return NULL;
+    if (hdr) {
+      oso_impl_copy((char *)m, (char const *)hdr,
+                    sizeof(oso_header) + hdr->len + 1);
+      oso_impl_freehdr(hdr);
+    } else {
+      ((oso_header *)m)->len = 0;
+      *(char *)((oso_header *)m + 1) = '\0';
+    }
+  }
+#if defined(MADV_HUGEPAGE)
+  madvise(m, bytes, MADV_HUGEPAGE);
+#endif
+  hdr = (oso_header *)m;
+  hdr->cap = (bytes - (sizeof(oso_header) + 1)) | OSO_FLAG_MAPPED;
+  return hdr + 1;
+}
+#endif
+
+/* Called when growing `*p` failed. Applies the alloc failure rule from the
+   header and returns 0 so callers can pass it along as their status. */
+static int
+oso_impl_allocfail(oso **p) {
+#if defined(OSO_KEEP_ON_ALLOC_FAILURE)
+  (void)p;
+#else
+  if (*p) {
+    oso_impl_freehdr(OSO_HDR(*p));
+    *p = NULL;
+  }
+#endif
+  return 0;
+}
+
+/* Returns null if the allocation failed, without freeing `hdr`. */
 OSO_INTERNAL oso *
 oso_impl_reallochdr(oso_header *hdr, size_t new_cap) {
+#if defined(OSO_MMAP)
+  if (sizeof(oso_header) + new_cap + 1 >= (size_t)(OSO_MMAP_THRESHOLD) ||
+      (hdr && (hdr->cap & OSO_FLAG_MAPPED)))
+    return oso_impl_mapgrow(hdr, new_cap);
+#endif
   if (hdr) {
-    oso_header *new_hdr = realloc(hdr, sizeof(oso_header) + new_cap + 1);
-    if (!new_hdr) {
-      free(hdr);
-      return NULL;
+    oso_header *new_hdr;
+    if (hdr->cap & OSO_FLAG_INLINE) {
+      /* Spill out of the caller's memory onto the heap. */
+      new_hdr = malloc(sizeof(oso_header) + new_cap + 1);
+      if (!new_hdr) return NULL;
+      memcpy(new_hdr, hdr, sizeof(oso_header) + hdr->len + 1);
+    } else {
+      new_hdr = realloc(hdr, sizeof(oso_header) + new_cap + 1);
+      if (!new_hdr) return NULL;
     }
     new_hdr->cap = new_cap;
     return new_hdr + 1;
@@ -82,46 +433,342 @@ oso_impl_reallochdr(oso_header *hdr, size_t new_cap) {
   return hdr + 1;
 }
 
+/* C89 has no va_copy(), but the compilers we care about have one of these. */
+#if defined(va_copy)
+#define OSO_VA_COPY(dst, src) va_copy(dst, src)
+#elif defined(__va_copy)
+#define OSO_VA_COPY(dst, src) __va_copy(dst, src)
+#endif
+
 struct oso_cbcontext {
   oso *s;
+  int ok;
+  size_t start_len;
   char tmp[STB_SPRINTF_MIN];
 };
 
 OSO_INTERNAL char *
 oso_impl_sprintfcb(const char *buf, void *user, int len) {
   struct oso_cbcontext *c = (struct oso_cbcontext *)user;
-  osocatlen(&c->s, buf, (size_t)len);
-  if (!c->s) return NULL;
+  if (!osocatlen(&c->s, buf, (size_t)len)) {
+    c->ok = 0;
+    return NULL;
+  }
   return c->tmp;
 }
 
-OSO_INTERNAL oso *
-oso_impl_catvprintf(oso *s, char const *fmt, va_list ap) {
+/* Custom conversion specifiers (see `osoformatregister()`). stb_sprintf has
+   no way to extend it, so a format that uses them is walked here instead.
+   Each standard conversion is handed to stb_sprintf on its own, with its
+   argument pulled off the va_list, and each custom one is handed to its
+   function. */
+#define OSO_FORMAT_MAX 32
+#define OSO_FORMAT_NAME_MAX 31
+
+static struct oso_format {
+  char name[OSO_FORMAT_NAME_MAX + 1];
+  int (*fn)(oso **p, va_list *ap);
+} oso_impl_formats[OSO_FORMAT_MAX];
+static size_t oso_impl_formatcount;
+
+int
+osoformatregister(char const *name, int (*fn)(oso **p, va_list *ap)) {
+  size_t len = strlen(name), i;
+  if (!len || len > OSO_FORMAT_NAME_MAX || strchr(name, '}')) return 0;
+  for (i = 0; i < oso_impl_formatcount; i++)
+    if (!strcmp(oso_impl_formats[i].name, name)) break;
+  if (i == OSO_FORMAT_MAX) return 0;
+  if (i == oso_impl_formatcount) {
+    memcpy(oso_impl_formats[i].name, name, len + 1);
+    oso_impl_formatcount++;
+  }
+  oso_impl_formats[i].fn = fn;
+  return 1;
+}
+
+static int (*oso_impl_findformat(char const *name, size_t len))(oso **,
+                                                                va_list *) {
+  size_t i;
+  for (i = 0; i < oso_impl_formatcount; i++)
+    if (!strncmp(oso_impl_formats[i].name, name, len) &&
+        !oso_impl_formats[i].name[len])
+      return oso_impl_formats[i].fn;
+  return NULL;
+}
+
+static int
+oso_impl_catspec1(struct oso_cbcontext *c, char const *spec, ...) {
+  va_list ap;
+  va_start(ap, spec);
+  oso_implsp_vsprintfcb(oso_impl_sprintfcb, c, c->tmp, spec, ap);
+  va_end(ap);
+  return c->ok;
+}
+
+/* intmax_t is C99. Where it's missing, the widest integer is 64 bits. */
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L
+#define OSO_INTMAX intmax_t
+#define OSO_UINTMAX uintmax_t
+#else
+#define OSO_INTMAX oso_i64
+#define OSO_UINTMAX oso_u64
+#endif
+
+/* Formats the standard conversion at `pct` and returns what's after it, or
+   null if an allocation failed. `*` widths and precisions are read here and
+   written into the spec as digits, so stb_sprintf only ever gets one
+   argument. The argument is read with the type its length modifier says, and
+   passed on as a type that stb_sprintf reads the same way. */
+OSO_INTERNAL char const *
+oso_impl_catspec(struct oso_cbcontext *c, char const *pct, va_list *ap) {
+  char spec[64];
+  char const *f = pct + 1;
+  size_t n = 1, width = 0;
+  int size = 0, ok, sign, prec = -1;
+  spec[0] = '%';
+  while (*f && strchr("-+ #0'$_", *f)) {
+    if (n < 16) spec[n++] = *f;
+    f++;
+  }
+  if (*f == '*') {
+    int w = va_arg(*ap, int);
+    if (w < 0) {
+      /* Ahead of the other flags, since stb_sprintf stops at a '0'. */
+      memmove(spec + 2, spec + 1, n - 1);
+      spec[1] = '-';
+      n++;
+      width = (size_t)-(w + 1) + 1;
+    } else {
+      width = (size_t)w;
+    }
+    f++;
+  }
+  for (; *f >= '0' && *f <= '9'; f++)
+    if (width < INT_MAX / 10) width = width * 10 + (size_t)(*f - '0');
+  if (*f == '.') {
+    prec = 0;
+    if (*++f == '*') {
+      prec = va_arg(*ap, int);
+      if (prec < 0) prec = -1;
+      f++;
+    }
+    for (; *f >= '0' && *f <= '9'; f++)
+      if (prec < INT_MAX / 10) prec = prec * 10 + (*f - '0');
+  }
+  if (width) n += (size_t)oso_implsp_sprintf(spec + n, "%zu", width);
+  if (prec >= 0) n += (size_t)oso_implsp_sprintf(spec + n, ".%d", prec);
+  /* size: 0 int, 1 long, 2 64-bit, 3 size_t, 4 ptrdiff_t, 5 intmax_t,
+     6 short, 7 char, 8 long double */
+  for (;; f++) {
+    if (*f == 'h') size = size == 6 ? 7 : 6;
+    else if (*f == 'l') size = size == 1 ? 2 : 1;
+    else if (*f == 'j') size = 5;
+    else if (*f == 'z') size = 3;
+    else if (*f == 't') size = 4;
+    else if (*f == 'L') size = 8;
+    else if (*f == 'I') {
+      size = 3;
+      if (f[1] == '6' && f[2] == '4') size = 2;
+      else if (f[1] == '3' && f[2] == '2') size = 0;
+      if (size != 3) f += 2;
+    } else break;
+  }
+  /* stb_sprintf reads the size of the argument from the spec too. Shorts and
+     chars arrive promoted to int, and a long double is passed on as a
+     double, so those don't need one. */
+  if (size == 1) spec[n++] = 'l';
+  else if (size == 2 || size == 5) {
+    spec[n++] = 'l';
+    spec[n++] = 'l';
+  }
+  else if (size == 3) spec[n++] = 'z';
+  else if (size == 4) spec[n++] = 't';
+  spec[n++] = *f;
+  spec[n] = '\0';
+  sign = *f == 'd' || *f == 'i';
+  switch (*f) {
+  case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'b':
+  case 'B': case 'c':
+    if (size == 1)
+      ok = sign ? oso_impl_catspec1(c, spec, va_arg(*ap, long))
+                : oso_impl_catspec1(c, spec, va_arg(*ap, unsigned long));
+    else if (size == 2)
+      ok = sign ? oso_impl_catspec1(c, spec, va_arg(*ap, oso_i64))
+                : oso_impl_catspec1(c, spec, va_arg(*ap, oso_u64));
+    else if (size == 5)
+      ok = sign
+        ? oso_impl_catspec1(c, spec, (oso_i64)va_arg(*ap, OSO_INTMAX))
+        : oso_impl_catspec1(c, spec, (oso_u64)va_arg(*ap, OSO_UINTMAX));
+    else if (size == 3)
+      ok = oso_impl_catspec1(c, spec, va_arg(*ap, size_t));
+    else if (size == 4)
+      ok = oso_impl_catspec1(c, spec, va_arg(*ap, ptrdiff_t));
+    else
+      ok = sign ? oso_impl_catspec1(c, spec, va_arg(*ap, int))
+                : oso_impl_catspec1(c, spec, va_arg(*ap, unsigned));
+    break;
+  case 'e': case 'E': case 'f': case 'g': case 'G': case 'a': case 'A':
+    if (size == 8)
+      ok = oso_impl_catspec1(c, spec, (double)va_arg(*ap, long double));
+    else
+      ok = oso_impl_catspec1(c, spec, va_arg(*ap, double));
+    break;
+  case 's': case 'p': case 'S':
+    ok = oso_impl_catspec1(c, spec, va_arg(*ap, void *));
+    break;
+  case 'n': {
+    size_t len = osolen(c->s) - c->start_len;
+    if (size == 1) *va_arg(*ap, long *) = (long)len;
+    else if (size == 2) *va_arg(*ap, oso_i64 *) = (oso_i64)len;
+    else if (size == 3) *va_arg(*ap, size_t *) = len;
+    else if (size == 4) *va_arg(*ap, ptrdiff_t *) = (ptrdiff_t)len;
+    else if (size == 5) *va_arg(*ap, OSO_INTMAX *) = (OSO_INTMAX)len;
+    else if (size == 6) *va_arg(*ap, short *) = (short)len;
+    else if (size == 7) *va_arg(*ap, signed char *) = (signed char)len;
+    else *va_arg(*ap, int *) = (int)len;
+    ok = 1;
+    break;
+  }
+  case '%':
+    ok = osocatlen(&c->s, "%", 1);
+    break;
+  case '\0':
+    return f;
+  default: /* Unknown, so it's written as is, like stb_sprintf does. */
+    ok = osocatlen(&c->s, pct, (size_t)(f + 1 - pct));
+    break;
+  }
+  return ok ? f + 1 : NULL;
+}
+
+OSO_INTERNAL int
+oso_impl_catformats(struct oso_cbcontext *c, char const *fmt, va_list *ap) {
+  while (*fmt) {
+    char const *pct = strchr(fmt, '%'), *close;
+    int (*fn)(oso **, va_list *);
+    if (!pct) return osocatlen(&c->s, fmt, strlen(fmt));
+    if (pct != fmt && !osocatlen(&c->s, fmt, (size_t)(pct - fmt))) return 0;
+    if (pct[1] != '{') {
+      fmt = oso_impl_catspec(c, pct, ap);
+      if (!fmt) return 0;
+      continue;
+    }
+    close = strchr(pct, '}');
+    fn = close ? oso_impl_findformat(pct + 2, (size_t)(close - pct - 2)) : NULL;
+    if (!fn) {
+      /* Unknown, so it's written as is. */
+      size_t len = close ? (size_t)(close + 1 - pct) : strlen(pct);
+      if (!osocatlen(&c->s, pct, len)) return 0;
+      fmt = pct + len;
+      continue;
+    }
+    if (!fn(&c->s, ap)) return 0;
+    fmt = close + 1;
+  }
+  return 1;
+}
+
+/* Whether the format has to be walked by `oso_impl_catformats()` instead of
+   going straight to stb_sprintf. */
+static int
+oso_impl_fmtwalk(char const *fmt) {
+  if (!oso_impl_formatcount) return 0;
+  while ((fmt = strchr(fmt, '%')) != NULL) {
+    fmt++;
+    if (*fmt == '{') return 1;
+    fmt += strspn(fmt, "-+ #0'$_*.0123456789hljztLI");
+    if (*fmt) fmt++;
+  }
+  return 0;
+}
+
+OSO_INTERNAL int
+oso_impl_catvprintf(oso **p, char const *fmt, va_list ap) {
   struct oso_cbcontext c;
-  c.s = s;
-  oso_implsp_vsprintfcb(oso_impl_sprintfcb, &c, c.tmp, fmt, ap);
-  return c.s;
+  size_t start_len = osolen(*p);
+  c.s = *p;
+  c.ok = 1;
+  c.start_len = start_len;
+#if defined(OSO_VA_COPY)
+  if (oso_impl_fmtwalk(fmt)) {
+    va_list args;
+    OSO_VA_COPY(args, ap);
+    if (!oso_impl_catformats(&c, fmt, &args)) c.ok = 0;
+    va_end(args);
+  } else
+#endif
+  {
+    oso_implsp_vsprintfcb(oso_impl_sprintfcb, &c, c.tmp, fmt, ap);
+  }
+  if (!c.ok && c.s) {
+    /* The string was kept, but may have some of the output on the end. */
+    OSO_HDR(c.s)->len = start_len;
+    OSO_DIRTY(OSO_HDR(c.s));
+    ((char *)c.s)[start_len] = '\0';
+  }
+  *p = c.s;
+  return c.ok;
+}
+
+OSO_INTERNAL int
+oso_impl_putvprintf(oso **p, char const *fmt, va_list ap) {
+#if defined(OSO_KEEP_ON_ALLOC_FAILURE)
+  /* The old contents have to survive a failure. Measure first, and if the
+     result fits, format it in place. If it doesn't, format into a new buffer
+     of the right size and only then let go of the old one. */
+  oso *s = *p, *fresh = NULL;
+  int n = -1;
+#if defined(OSO_VA_COPY)
+  /* Custom specifiers can't be measured without running them, so formats
+     that use them always take the new buffer. */
+  if (!oso_impl_fmtwalk(fmt)) {
+    va_list measure;
+    OSO_VA_COPY(measure, ap);
+    n = oso_implsp_vsnprintf(NULL, 0, fmt, measure);
+    va_end(measure);
+    if (s && n >= 0 && n < INT_MAX && OSO_CAPOF(OSO_HDR(s)) >= (size_t)n) {
+      oso_implsp_vsnprintf((char *)s, n + 1, fmt, ap);
+      OSO_HDR(s)->len = (size_t)n;
+      OSO_DIRTY(OSO_HDR(s));
+      return 1;
+    }
+  }
+#endif
+  if (n > 0 && !osoensurecap(&fresh, (size_t)n)) return 0;
+  if (!oso_impl_catvprintf(&fresh, fmt, ap)) {
+    osofree(fresh);
+    return 0;
+  }
+  osofree(s);
+  *p = fresh;
+  return 1;
+#else
+  oso *s = *p;
+  if (s) {
+    OSO_HDR(s)->len = 0;
+    OSO_DIRTY(OSO_HDR(s));
+    ((char *)s)[0] = '\0';
+  }
+  return oso_impl_catvprintf(p, fmt, ap);
+#endif
 }
 
-OSO_NOINLINE void
+OSO_NOINLINE int
 osoensurecap(oso **p, size_t new_cap) {
   oso *s = *p;
   oso_header *hdr = NULL;
-  if (new_cap > OSO_CAP_MAX) {
-    if (s) {
-      free(OSO_HDR(s));
-      *p = NULL;
-    }
-    return;
-  }
+  if (new_cap > OSO_CAP_MAX) return oso_impl_allocfail(p);
   if (s) {
     hdr = OSO_HDR(s);
-    if (hdr->cap >= new_cap) return;
+    if (OSO_CAPOF(hdr) >= new_cap) return 1;
   }
-  *p = oso_impl_reallochdr(hdr, new_cap);
+  s = oso_impl_reallochdr(hdr, new_cap);
+  if (!s) return oso_impl_allocfail(p);
+  *p = s;
+  return 1;
 }
 
-OSO_NOINLINE void
+OSO_NOINLINE int
 osomakeroomfor(oso **p, size_t add_len) {
   oso *s = *p;
   oso_header *hdr = NULL;
@@ -130,103 +777,162 @@ osomakeroomfor(oso **p, size_t add_len) {
     size_t len, cap;
     hdr = OSO_HDR(s);
     len = hdr->len;
-    cap = hdr->cap;
-    if (len > OSO_CAP_MAX - add_len) { /* overflow, goodnight */
-      free(hdr);
-      *p = NULL;
-      return;
-    }
+    cap = OSO_CAPOF(hdr);
+    if (len > OSO_CAP_MAX - add_len) /* overflow, goodnight */
+      return oso_impl_allocfail(p);
     new_cap = len + add_len;
-    if (cap >= new_cap) return;
+    if (cap >= new_cap) return 1;
+    /* At least double it, so that appending in small pieces only
+       reallocates a logarithmic number of times. */
+    if (new_cap < cap * 2)
+      new_cap = cap > OSO_CAP_MAX / 2 ? OSO_CAP_MAX : cap * 2;
   } else {
-    if (add_len > OSO_CAP_MAX) return;
+    if (add_len > OSO_CAP_MAX) return 0;
     new_cap = add_len;
   }
-  *p = oso_impl_reallochdr(hdr, new_cap);
+  s = oso_impl_reallochdr(hdr, new_cap);
+  if (!s) return oso_impl_allocfail(p);
+  *p = s;
+  return 1;
 }
 
-void
+int
 osoput(oso **p, char const *cstr) {
-  osoputlen(p, cstr, strlen(cstr));
+  return osoputlen(p, cstr, strlen(cstr));
 }
 
-OSO_NOINLINE void
+OSO_NOINLINE int
 osoputlen(oso **p, char const *cstr, size_t len) {
-  oso *s = *p;
-  osoensurecap(&s, len);
-  if (s) {
-    OSO_HDR(s)->len = len;
-    memcpy((char *)s, cstr, len);
-    ((char *)s)[len] = '\0';
-  }
-  *p = s;
+  oso *s;
+  if (!osoensurecap(p, len)) return 0;
+  s = *p;
+  OSO_HDR(s)->len = len;
+  OSO_DIRTY(OSO_HDR(s));
+  oso_impl_copy((char *)s, cstr, len);
+  ((char *)s)[len] = '\0';
+  return 1;
 }
 
-void
+int
 osoputoso(oso **p, oso const *other) {
-  if (!other) return;
-  osoputlen(p, (char const *)other, OSO_HDR(other)->len);
+  if (!other) return 1;
+  return osoputlen(p, (char const *)other, OSO_HDR(other)->len);
 }
 
-void
+int
 osoputvprintf(oso **p, char const *fmt, va_list ap) {
-  oso *s = *p;
-  if (s) {
-    OSO_HDR(s)->len = 0;
-    ((char *)s)[0] = '\0';
-  }
-  *p = oso_impl_catvprintf(s, fmt, ap);
+  return oso_impl_putvprintf(p, fmt, ap);
 }
 
-void
+int
 osoputprintf(oso **p, char const *fmt, ...) {
-  oso *s = *p;
+  int ok;
   va_list ap;
-  if (s) {
-    OSO_HDR(s)->len = 0;
-    ((char *)s)[0] = '\0';
-  }
   va_start(ap, fmt);
-  *p = oso_impl_catvprintf(s, fmt, ap);
+  ok = oso_impl_putvprintf(p, fmt, ap);
   va_end(ap);
+  return ok;
 }
 
-void
+int
 osocat(oso **p, char const *cstr) {
-  osocatlen(p, cstr, strlen(cstr));
+  return osocatlen(p, cstr, strlen(cstr));
 }
 
-OSO_NOINLINE void
+OSO_NOINLINE int
 osocatlen(oso **p, char const *cstr, size_t len) {
-  oso *s = *p;
-  osomakeroomfor(&s, len);
-  if (s) {
-    oso_header *hdr = OSO_HDR(s);
-    size_t curr_len = hdr->len;
-    memcpy((char *)s + curr_len, cstr, len);
-    ((char *)s)[curr_len + len] = '\0';
-    hdr->len = curr_len + len;
-  }
-  *p = s;
+  oso_header *hdr;
+  size_t curr_len;
+  if (!osomakeroomfor(p, len)) return 0;
+  hdr = OSO_HDR(*p);
+  curr_len = hdr->len;
+  oso_impl_copy((char *)*p + curr_len, cstr, len);
+  ((char *)*p)[curr_len + len] = '\0';
+  hdr->len = curr_len + len;
+  OSO_DIRTY(hdr);
+  return 1;
 }
 
-void
+int
 osocatoso(oso **p, oso const *other) {
-  if (!other) return;
-  osocatlen(p, (char const *)other, OSO_HDR(other)->len);
+  if (!other) return 1;
+  return osocatlen(p, (char const *)other, OSO_HDR(other)->len);
 }
 
-void
+int
 osocatvprintf(oso **p, char const *fmt, va_list ap) {
-  *p = oso_impl_catvprintf(*p, fmt, ap);
+  return oso_impl_catvprintf(p, fmt, ap);
 }
 
-void
+int
 osocatprintf(oso **p, char const *fmt, ...) {
+  int ok;
+  va_list ap;
+  va_start(ap, fmt);
+  ok = oso_impl_catvprintf(p, fmt, ap);
+  va_end(ap);
+  return ok;
+}
+
+size_t
+osocatbounded(oso *s, char const *cstr) {
+  return osocatlenbounded(s, cstr, strlen(cstr));
+}
+
+size_t
+osocatlenbounded(oso *s, char const *cstr, size_t len) {
+  oso_header *hdr;
+  size_t n;
+  if (!s) return len;
+  hdr = OSO_HDR(s);
+  n = OSO_CAPOF(hdr) - hdr->len;
+  if (n > len) n = len;
+  memcpy((char *)s + hdr->len, cstr, n);
+  hdr->len += n;
+  ((char *)s)[hdr->len] = '\0';
+  OSO_DIRTY(hdr);
+  return len - n;
+}
+
+size_t
+osocatvprintfbounded(oso *s, char const *fmt, va_list ap) {
+  oso_header *hdr;
+  size_t room;
+  int total, written;
+  if (!s) return (size_t)oso_implsp_vsnprintf(NULL, 0, fmt, ap);
+  hdr = OSO_HDR(s);
+  room = OSO_CAPOF(hdr) - hdr->len;
+  if (room > INT_MAX - 1) room = INT_MAX - 1;
+  /* stb's vsnprintf clamps to the count and returns the untruncated length. */
+  total = oso_implsp_vsnprintf((char *)s + hdr->len, (int)room + 1, fmt, ap);
+  written = total < (int)room ? total : (int)room;
+  hdr->len += (size_t)written;
+  OSO_DIRTY(hdr);
+  return (size_t)(total - written);
+}
+
+size_t
+osocatprintfbounded(oso *s, char const *fmt, ...) {
+  size_t dropped;
   va_list ap;
   va_start(ap, fmt);
-  *p = oso_impl_catvprintf(*p, fmt, ap);
+  dropped = osocatvprintfbounded(s, fmt, ap);
   va_end(ap);
+  return dropped;
+}
+
+oso *
+osoinitbuf(void *buf, size_t size) {
+  oso_header *hdr = (oso_header *)buf;
+  size_t cap;
+  if (size < sizeof(oso_header) + 1) return NULL;
+  cap = size - (sizeof(oso_header) + 1);
+  if (cap > OSO_CAP_MAX) cap = OSO_CAP_MAX;
+  hdr->len = 0;
+  hdr->cap = cap | OSO_FLAG_INLINE;
+  OSO_DIRTY(hdr);
+  ((char *)(hdr + 1))[0] = '\0';
+  return hdr + 1;
 }
 
 void
@@ -234,12 +940,13 @@ osoclear(oso **p) {
   oso *s = *p;
   if (!s) return;
   OSO_HDR(s)->len = 0;
+  OSO_DIRTY(OSO_HDR(s));
   ((char *)s)[0] = '\0';
 }
 
 void
 osofree(oso *s) {
-  if (s) free(OSO_HDR(s));
+  if (s) oso_impl_freehdr(OSO_HDR(s));
 }
 
 void
@@ -258,6 +965,7 @@ ososwap(oso **a, oso **b) {
 void
 osopokelen(oso *s, size_t len) {
   OSO_HDR(s)->len = len;
+  OSO_DIRTY(OSO_HDR(s));
 }
 
 size_t
@@ -267,7 +975,7 @@ osolen(oso const *s) {
 
 size_t
 osocap(oso const *s) {
-  return s ? OSO_HDR(s)->cap : 0;
+  return s ? OSO_CAPOF(OSO_HDR(s)) : 0;
 }
 
 void
@@ -280,7 +988,7 @@ osolencap(oso const *s, size_t *out_len, size_t *out_cap) {
   }
   hdr = OSO_HDR(s);
   *out_len = hdr->len;
-  *out_cap = hdr->cap;
+  *out_cap = OSO_CAPOF(hdr);
 }
 
 size_t
@@ -288,7 +996,7 @@ osoavail(oso const *s) {
   oso_header *h;
   if (!s) return 0;
   h = OSO_HDR(s);
-  return h->cap - h->len;
+  return OSO_CAPOF(h) - h->len;
 }
 
 void
@@ -302,11 +1010,3176 @@ osotrim(oso *s, char const *cut_set) {
   while (end_pos > start_pos && strchr(cut_set, *end_pos)) end_pos--;
   len = (start_pos > end_pos) ? 0 : ((size_t)(end_pos - start_pos) + 1);
   OSO_HDR(s)->len = len;
+  OSO_DIRTY(OSO_HDR(s));
   if (str != start_pos) memmove(str, start_pos, len);
   str[len] = '\0';
 }
 
+int
+osoinsert(oso **p, size_t pos, char const *cstr, size_t len) {
+  return ososplice(p, pos, 0, cstr, len);
+}
+
+void
+osoerase(oso *s, size_t pos, size_t len) {
+  oso_header *hdr;
+  size_t curr_len;
+  if (!s) return;
+  hdr = OSO_HDR(s);
+  curr_len = hdr->len;
+  if (pos >= curr_len) return;
+  if (len > curr_len - pos) len = curr_len - pos;
+  memmove((char *)s + pos, (char *)s + pos + len, curr_len - pos - len + 1);
+  hdr->len = curr_len - len;
+  OSO_DIRTY(hdr);
+}
+
+OSO_NOINLINE int
+ososplice(oso **p, size_t pos, size_t del_len, char const *cstr, size_t len) {
+  oso *s = *p;
+  size_t curr_len = osolen(s);
+  char *str;
+  if (pos > curr_len) pos = curr_len;
+  if (del_len > curr_len - pos) del_len = curr_len - pos;
+  if (len > del_len) {
+    if (!osomakeroomfor(p, len - del_len)) return 0;
+    s = *p;
+  } else if (!s) {
+    return 1;
+  }
+  str = (char *)s;
+  if (len != del_len)
+    memmove(str + pos + len, str + pos + del_len,
+            curr_len - pos - del_len + 1);
+  memcpy(str + pos, cstr, len);
+  OSO_HDR(s)->len = curr_len - del_len + len;
+  OSO_DIRTY(OSO_HDR(s));
+  return 1;
+}
+
+/* UTF-8 validation uses the lookup table algorithm from Keiser and Lemire,
+   "Validating UTF-8 In Less Than One Instruction Per Byte". The high nibble of
+   the previous byte, the low nibble of the previous byte, and the high nibble
+   of the current byte each index a table of error bits. A byte pair is bad if
+   the same bit is set in all three lookups. Only the 3rd and 4th continuation
+   bytes of long sequences need to be checked separately. */
+#define OSO_UTF8_TBL_PREV_HI                                            \
+  0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, (char)0x80, (char)0x80, \
+    (char)0x80, (char)0x80, 0x21, 0x01, 0x15, 0x49
+#define OSO_UTF8_TBL_PREV_LO                                           \
+  (char)0xE7, (char)0xA3, (char)0x83, (char)0x83, (char)0x8B, (char)0xCB, \
+    (char)0xCB, (char)0xCB, (char)0xCB, (char)0xCB, (char)0xCB, (char)0xCB, \
+    (char)0xCB, (char)0xDB, (char)0xCB, (char)0xCB
+#define OSO_UTF8_TBL_CURR_HI                                            \
+  0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, (char)0xE6, (char)0xAE, \
+    (char)0xBA, (char)0xBA, 0x01, 0x01, 0x01, 0x01
+#define OSO_UTF8_INCOMPLETE_TAIL (char)0xEF, (char)0xDF, (char)0xBF
+
+#if !defined(OSO_AVX2) && !defined(OSO_SSSE3)
+OSO_INTERNAL int
+oso_impl_utf8scalar(unsigned char const *s, size_t len) {
+  size_t i = 0;
+  while (i < len) {
+    unsigned char c = s[i];
+    size_t need, k;
+    unsigned char lo = 0x80, hi = 0xBF;
+    if (c < 0x80) {
+      i++;
+      continue;
+    }
+    if (c < 0xC2) return 0;
+    if (c < 0xE0) {
+      need = 1;
+    } else if (c < 0xF0) {
+      need = 2;
+      if (c == 0xE0) lo = 0xA0;
+      if (c == 0xED) hi = 0x9F;
+    } else if (c < 0xF5) {
+      need = 3;
+      if (c == 0xF0) lo = 0x90;
+      if (c == 0xF4) hi = 0x8F;
+    } else {
+      return 0;
+    }
+    if (len - i <= need) return 0;
+    if (s[i + 1] < lo || s[i + 1] > hi) return 0;
+    for (k = 2; k <= need; k++)
+      if ((s[i + k] & 0xC0) != 0x80) return 0;
+    i += need + 1;
+  }
+  return 1;
+}
+#endif
+
+#if defined(OSO_AVX2)
+OSO_INTERNAL int
+oso_impl_utf8avx2(unsigned char const *src, size_t len, unsigned char *dst) {
+  __m256i const prev_hi = _mm256_setr_epi8(
+    OSO_UTF8_TBL_PREV_HI, OSO_UTF8_TBL_PREV_HI);
+  __m256i const prev_lo = _mm256_setr_epi8(
+    OSO_UTF8_TBL_PREV_LO, OSO_UTF8_TBL_PREV_LO);
+  __m256i const curr_hi = _mm256_setr_epi8(
+    OSO_UTF8_TBL_CURR_HI, OSO_UTF8_TBL_CURR_HI);
+  __m256i const max_tail = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, OSO_UTF8_INCOMPLETE_TAIL);
+  __m256i const nib = _mm256_set1_epi8(0x0F);
+  __m256i prev = _mm256_setzero_si256(), incomplete = prev, err = prev, in;
+  unsigned char tail[32];
+  size_t i;
+  for (i = 0; i < len; i += 32) {
+    if (len - i >= 32) {
+      in = _mm256_loadu_si256((__m256i const *)(src + i));
+      if (dst) _mm256_storeu_si256((__m256i *)(dst + i), in);
+    } else {
+      memset(tail, 0, sizeof tail);
+      memcpy(tail, src + i, len - i);
+      if (dst) memcpy(dst + i, src + i, len - i);
+      in = _mm256_loadu_si256((__m256i const *)tail);
+    }
+    if (_mm256_movemask_epi8(in) == 0) {
+      err = _mm256_or_si256(err, incomplete);
+      incomplete = _mm256_setzero_si256();
+    } else {
+      __m256i carry = _mm256_permute2x128_si256(prev, in, 0x21);
+      __m256i p1 = _mm256_alignr_epi8(in, carry, 15);
+      __m256i p2 = _mm256_alignr_epi8(in, carry, 14);
+      __m256i p3 = _mm256_alignr_epi8(in, carry, 13);
+      __m256i sc = _mm256_and_si256(
+        _mm256_and_si256(
+          _mm256_shuffle_epi8(
+            prev_hi, _mm256_and_si256(_mm256_srli_epi16(p1, 4), nib)),
+          _mm256_shuffle_epi8(prev_lo, _mm256_and_si256(p1, nib))),
+        _mm256_shuffle_epi8(
+          curr_hi, _mm256_and_si256(_mm256_srli_epi16(in, 4), nib)));
+      __m256i must23 = _mm256_and_si256(
+        _mm256_or_si256(_mm256_subs_epu8(p2, _mm256_set1_epi8(0x60)),
+          _mm256_subs_epu8(p3, _mm256_set1_epi8(0x70))),
+        _mm256_set1_epi8((char)0x80));
+      err = _mm256_or_si256(err, _mm256_xor_si256(must23, sc));
+      incomplete = _mm256_subs_epu8(in, max_tail);
+    }
+    prev = in;
+  }
+  err = _mm256_or_si256(err, incomplete);
+  return _mm256_testz_si256(err, err);
+}
+#endif
+
+#if defined(OSO_SSSE3) && !defined(OSO_AVX2)
+OSO_INTERNAL int
+oso_impl_utf8ssse3(unsigned char const *src, size_t len, unsigned char *dst) {
+  __m128i const prev_hi = _mm_setr_epi8(OSO_UTF8_TBL_PREV_HI);
+  __m128i const prev_lo = _mm_setr_epi8(OSO_UTF8_TBL_PREV_LO);
+  __m128i const curr_hi = _mm_setr_epi8(OSO_UTF8_TBL_CURR_HI);
+  __m128i const max_tail = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, OSO_UTF8_INCOMPLETE_TAIL);
+  __m128i const nib = _mm_set1_epi8(0x0F);
+  __m128i prev = _mm_setzero_si128(), incomplete = prev, err = prev, in;
+  unsigned char tail[16];
+  size_t i;
+  for (i = 0; i < len; i += 16) {
+    if (len - i >= 16) {
+      in = _mm_loadu_si128((__m128i const *)(src + i));
+      if (dst) _mm_storeu_si128((__m128i *)(dst + i), in);
+    } else {
+      memset(tail, 0, sizeof tail);
+      memcpy(tail, src + i, len - i);
+      if (dst) memcpy(dst + i, src + i, len - i);
+      in = _mm_loadu_si128((__m128i const *)tail);
+    }
+    if (_mm_movemask_epi8(in) == 0) {
+      err = _mm_or_si128(err, incomplete);
+      incomplete = _mm_setzero_si128();
+    } else {
+      __m128i p1 = _mm_alignr_epi8(in, prev, 15);
+      __m128i p2 = _mm_alignr_epi8(in, prev, 14);
+      __m128i p3 = _mm_alignr_epi8(in, prev, 13);
+      __m128i sc = _mm_and_si128(
+        _mm_and_si128(
+          _mm_shuffle_epi8(prev_hi, _mm_and_si128(_mm_srli_epi16(p1, 4), nib)),
+          _mm_shuffle_epi8(prev_lo, _mm_and_si128(p1, nib))),
+        _mm_shuffle_epi8(curr_hi, _mm_and_si128(_mm_srli_epi16(in, 4), nib)));
+      __m128i must23 = _mm_and_si128(
+        _mm_or_si128(_mm_subs_epu8(p2, _mm_set1_epi8(0x60)),
+          _mm_subs_epu8(p3, _mm_set1_epi8(0x70))),
+        _mm_set1_epi8((char)0x80));
+      err = _mm_or_si128(err, _mm_xor_si128(must23, sc));
+      incomplete = _mm_subs_epu8(in, max_tail);
+    }
+    prev = in;
+  }
+  err = _mm_or_si128(err, incomplete);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(err, _mm_setzero_si128())) == 0xFFFF;
+}
+#endif
+
+/* Validates `len` bytes at `src`. If `dst` isn't null, also copies them there
+   in the same pass. */
+OSO_INTERNAL int
+oso_impl_utf8valid(char const *src, size_t len, char *dst) {
+#if defined(OSO_AVX2)
+  return oso_impl_utf8avx2(
+    (unsigned char const *)src, len, (unsigned char *)dst);
+#elif defined(OSO_SSSE3)
+  return oso_impl_utf8ssse3(
+    (unsigned char const *)src, len, (unsigned char *)dst);
+#else
+  if (dst) memcpy(dst, src, len);
+  return oso_impl_utf8scalar((unsigned char const *)src, len);
+#endif
+}
+
+int
+osoutf8valid(oso const *s) {
+  if (!s) return 1;
+  return oso_impl_utf8valid((char const *)s, OSO_HDR(s)->len, NULL);
+}
+
+size_t
+osoutf8count(oso const *s) {
+  unsigned char const *str;
+  size_t len, i = 0, conts = 0;
+  if (!s) return 0;
+  str = (unsigned char const *)s;
+  len = OSO_HDR(s)->len;
+#if defined(OSO_SSE2)
+  while (len - i >= 16) {
+    __m128i acc = _mm_setzero_si128(), sum;
+    int n;
+    /* Continuation bytes are the only ones less than -64 as signed chars.
+       Each lane of the accumulator can count up to 255 of them. */
+    for (n = 0; n < 255 && len - i >= 16; n++, i += 16) {
+      __m128i in = _mm_loadu_si128((__m128i const *)(str + i));
+      acc = _mm_sub_epi8(acc, _mm_cmplt_epi8(in, _mm_set1_epi8(-64)));
+    }
+    sum = _mm_sad_epu8(acc, _mm_setzero_si128());
+    conts += (size_t)_mm_cvtsi128_si32(sum) +
+             (size_t)_mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+  }
+#endif
+  for (; i < len; i++) conts += (str[i] & 0xC0) == 0x80;
+  return len - conts;
+}
+
+int
+osocatutf8len(oso **p, char const *cstr, size_t len) {
+  oso *s;
+  oso_header *hdr;
+  size_t curr_len;
+  if (!osomakeroomfor(p, len)) return 0;
+  s = *p;
+  hdr = OSO_HDR(s);
+  curr_len = hdr->len;
+  if (!oso_impl_utf8valid(cstr, len, (char *)s + curr_len)) {
+    ((char *)s)[curr_len] = '\0';
+    return 0;
+  }
+  ((char *)s)[curr_len + len] = '\0';
+  hdr->len = curr_len + len;
+  OSO_DIRTY(hdr);
+  return 1;
+}
+
+#undef OSO_UTF8_TBL_PREV_HI
+#undef OSO_UTF8_TBL_PREV_LO
+#undef OSO_UTF8_TBL_CURR_HI
+#undef OSO_UTF8_INCOMPLETE_TAIL
+
+/* wyhash (Wang Yi's final version 4), with the default secret. Each step
+   multiplies two 64-bit words into a 128-bit product and folds its halves
+   together, so every input bit reaches every output bit. Inputs over 48 bytes
+   are hashed in three independent lanes. The words are read as little-endian,
+   so a string hashes the same on every platform. */
+#define OSO_HASH_S0 OSO_U64(0xA0761D64, 0x78BD642F)
+#define OSO_HASH_S1 OSO_U64(0xE7037ED1, 0xA0B428DB)
+#define OSO_HASH_S2 OSO_U64(0x8EBC6AF0, 0x9C88C6E3)
+#define OSO_HASH_S3 OSO_U64(0x589965CC, 0x75374CC3)
+
+/* Multiplies `*a` by `*b`, leaving the low half of the product in `*a` and the
+   high half in `*b`. */
+static void
+oso_impl_mum(oso_u64 *a, oso_u64 *b) {
+#if defined(__SIZEOF_INT128__)
+  __extension__ typedef unsigned __int128 oso_u128;
+  oso_u128 r = (oso_u128)*a * *b;
+  *a = (oso_u64)r;
+  *b = (oso_u64)(r >> 64);
+#else
+  oso_u64 ha = *a >> 32, hb = *b >> 32;
+  oso_u64 la = *a & 0xFFFFFFFFu, lb = *b & 0xFFFFFFFFu;
+  oso_u64 rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  oso_u64 t = rl + (rm0 << 32), lo;
+  oso_u64 carry = t < rl;
+  lo = t + (rm1 << 32);
+  carry += lo < t;
+  *a = lo;
+  *b = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+#endif
+}
+
+static oso_u64
+oso_impl_mix(oso_u64 a, oso_u64 b) {
+  oso_impl_mum(&a, &b);
+  return a ^ b;
+}
+
+static oso_u64
+oso_impl_load4(unsigned char const *s) {
+  return (oso_u64)s[0] | (oso_u64)s[1] << 8 | (oso_u64)s[2] << 16 |
+         (oso_u64)s[3] << 24;
+}
+
+OSO_INTERNAL oso_u64
+oso_impl_hash(char const *str, size_t len) {
+  unsigned char const *u = (unsigned char const *)str;
+  oso_u64 seed = oso_impl_mix(OSO_HASH_S0, OSO_HASH_S1), a, b;
+  if (len <= 16) {
+    if (len >= 4) {
+      size_t mid = (len >> 3) << 2;
+      a = oso_impl_load4(u) << 32 | oso_impl_load4(u + mid);
+      b = oso_impl_load4(u + len - 4) << 32 | oso_impl_load4(u + len - 4 - mid);
+    } else if (len) {
+      a = (oso_u64)u[0] << 16 | (oso_u64)u[len >> 1] << 8 | u[len - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = len;
+    if (i > 48) {
+      oso_u64 see1 = seed, see2 = seed;
+      do {
+        seed = oso_impl_mix(oso_impl_load8(u) ^ OSO_HASH_S1,
+                            oso_impl_load8(u + 8) ^ seed);
+        see1 = oso_impl_mix(oso_impl_load8(u + 16) ^ OSO_HASH_S2,
+                            oso_impl_load8(u + 24) ^ see1);
+        see2 = oso_impl_mix(oso_impl_load8(u + 32) ^ OSO_HASH_S3,
+                            oso_impl_load8(u + 40) ^ see2);
+        u += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= see1 ^ see2;
+    }
+    for (; i > 16; u += 16, i -= 16)
+      seed = oso_impl_mix(oso_impl_load8(u) ^ OSO_HASH_S1,
+                          oso_impl_load8(u + 8) ^ seed);
+    a = oso_impl_load8(u + i - 16);
+    b = oso_impl_load8(u + i - 8);
+  }
+  a ^= OSO_HASH_S1;
+  b ^= seed;
+  oso_impl_mum(&a, &b);
+  a = oso_impl_mix(a ^ OSO_HASH_S0 ^ (oso_u64)len, b ^ OSO_HASH_S1);
+  return a;
+}
+
+oso_u64
+osohash(oso const *s) {
+  oso_u64 h;
+  if (!s) return oso_impl_hash("", 0);
+#if defined(OSO_CACHE_HASH)
+  if (OSO_HDR(s)->cap & OSO_FLAG_HASHED) return OSO_HDR(s)->hash;
+  h = oso_impl_hash((char const *)s, OSO_HDR(s)->len);
+  OSO_HDR(s)->hash = h;
+  OSO_HDR(s)->cap |= OSO_FLAG_HASHED;
+#else
+  h = oso_impl_hash((char const *)s, OSO_HDR(s)->len);
+#endif
+  return h;
+}
+
+int
+osoeq(oso const *a, oso const *b) {
+  size_t len = osolen(a);
+  if (len != osolen(b)) return 0;
+  if (!len || a == b) return 1;
+#if defined(OSO_CACHE_HASH)
+  {
+    oso_header const *ha = OSO_HDR(a), *hb = OSO_HDR(b);
+    if ((ha->cap & hb->cap & OSO_FLAG_HASHED) && ha->hash != hb->hash)
+      return 0;
+  }
+#endif
+  return memcmp(a, b, len) == 0;
+}
+
+int
+osocmp(oso const *a, oso const *b) {
+  size_t alen = osolen(a), blen = osolen(b);
+  int res = 0;
+  if (alen && blen) res = memcmp(a, b, alen < blen ? alen : blen);
+  if (res) return res;
+  return alen < blen ? -1 : alen > blen;
+}
+
+int
+osostartswith(oso const *s, oso const *prefix) {
+  size_t len = osolen(prefix);
+  if (len > osolen(s)) return 0;
+  return !len || memcmp(s, prefix, len) == 0;
+}
+
+int
+osoendswith(oso const *s, oso const *suffix) {
+  size_t len = osolen(suffix), slen = osolen(s);
+  if (len > slen) return 0;
+  return !len || memcmp((char const *)s + slen - len, suffix, len) == 0;
+}
+
+/* Sorting is a multikey quicksort (Bentley and Sedgewick) that works on a
+   whole machine word of each string at a time instead of a single character.
+   Each item caches the big-endian word of its string at the current depth,
+   plus how many characters are left (capped at one more than a word), so that
+   partitioning compares plain integers in a contiguous array instead of
+   chasing pointers into every string. */
+struct oso_sortitem {
+  oso *s;
+  size_t word, rest;
+};
+
+OSO_INTERNAL void
+oso_impl_sortload(struct oso_sortitem *a, size_t n, size_t depth) {
+  size_t i, k;
+  for (i = 0; i < n; i++) {
+    unsigned char const *str = (unsigned char const *)a[i].s;
+    size_t len = osolen(a[i].s), w = 0;
+    for (k = 0; k < sizeof(size_t); k++) {
+      w <<= 8;
+      if (depth + k < len) w |= str[depth + k];
+    }
+    a[i].word = w;
+    a[i].rest =
+      len - depth > sizeof(size_t) ? sizeof(size_t) + 1 : len - depth;
+  }
+}
+
+static int
+oso_impl_sortkeycmp(
+  struct oso_sortitem const *x, struct oso_sortitem const *y) {
+  if (x->word != y->word) return x->word < y->word ? -1 : 1;
+  if (x->rest != y->rest) return x->rest < y->rest ? -1 : 1;
+  return 0;
+}
+
+/* Partitions `a` three ways around a median-of-three pivot, by the key loaded
+   at the current depth: less than the pivot in [0, *out_lt), equal in
+   [*out_lt, *out_gt), and greater in [*out_gt, n). Returns 1 if the equal
+   ones still need sorting from the next word on, or 0 if the pivot ended
+   within this word, which means they're all the same string. */
+OSO_INTERNAL int
+oso_impl_sortpartition(struct oso_sortitem *a, size_t n, size_t *out_lt,
+                       size_t *out_gt) {
+  struct oso_sortitem pivot, tmp;
+  size_t lt = 0, i = 0, gt = n;
+  {
+    struct oso_sortitem const *x = a, *y = a + n / 2, *z = a + n - 1;
+    if (oso_impl_sortkeycmp(x, y) > 0) {
+      struct oso_sortitem const *t = x;
+      x = y;
+      y = t;
+    }
+    if (oso_impl_sortkeycmp(y, z) > 0)
+      y = oso_impl_sortkeycmp(x, z) > 0 ? x : z;
+    pivot = *y;
+  }
+  while (i < gt) {
+    int c = oso_impl_sortkeycmp(a + i, &pivot);
+    if (c < 0) {
+      tmp = a[lt];
+      a[lt++] = a[i];
+      a[i++] = tmp;
+    } else if (c > 0) {
+      tmp = a[--gt];
+      a[gt] = a[i];
+      a[i] = tmp;
+    } else {
+      i++;
+    }
+  }
+  *out_lt = lt;
+  *out_gt = gt;
+  return pivot.rest > sizeof(size_t);
+}
+
+OSO_INTERNAL void
+oso_impl_sortrange(struct oso_sortitem *a, size_t n, size_t depth) {
+  struct oso_sortitem tmp;
+  size_t lt, i, gt, nl, nm, ng;
+  while (n > 1) {
+    if (n < 12) {
+      for (i = 1; i < n; i++) {
+        tmp = a[i];
+        for (lt = i; lt > 0 && osocmp(a[lt - 1].s, tmp.s) > 0; lt--)
+          a[lt] = a[lt - 1];
+        a[lt] = tmp;
+      }
+      return;
+    }
+    nm = oso_impl_sortpartition(a, n, &lt, &gt) ? gt - lt : 0;
+    nl = lt;
+    ng = n - gt;
+    /* Recurse into the two smaller parts and loop on the biggest one. Those
+       two are each at most half of `n`, so the stack stays shallower than
+       log2(n) calls, whatever the input. The middle part is sorted from the
+       next word on. */
+    if (nm >= nl && nm >= ng) {
+      oso_impl_sortrange(a, nl, depth);
+      oso_impl_sortrange(a + gt, ng, depth);
+      a += lt;
+      n = nm;
+      depth += sizeof(size_t);
+      oso_impl_sortload(a, n, depth);
+      continue;
+    }
+    if (nm) {
+      oso_impl_sortload(a + lt, nm, depth + sizeof(size_t));
+      oso_impl_sortrange(a + lt, nm, depth + sizeof(size_t));
+    }
+    if (nl >= ng) {
+      oso_impl_sortrange(a + gt, ng, depth);
+      n = nl;
+    } else {
+      oso_impl_sortrange(a, nl, depth);
+      a += gt;
+      n = ng;
+    }
+  }
+}
+
+/* Sorts with at least this many strings are split across the thread pool,
+   when there is one. */
+#ifndef OSO_PARALLEL_SORT_MIN
+#define OSO_PARALLEL_SORT_MIN ((size_t)1 << 16)
+#endif
+
+struct oso_sorttask {
+  struct oso_sortitem *a;
+  size_t n, depth;
+};
+
+static int
+oso_impl_sorttaskcmp(void const *x, void const *y) {
+  size_t nx = ((struct oso_sorttask const *)x)->n;
+  size_t ny = ((struct oso_sorttask const *)y)->n;
+  return nx > ny ? -1 : nx < ny;
+}
+
+static void
+oso_impl_sorttaskrun(void *arg, size_t part, size_t parts) {
+  struct oso_sorttask const *t = (struct oso_sorttask const *)arg + part;
+  (void)parts;
+  oso_impl_sortrange(t->a, t->n, t->depth);
+}
+
+/* Partitions the biggest remaining range until there are a few independent
+   ranges for each thread, then sorts them all on the thread pool, biggest
+   first. Returns non-zero if it couldn't allocate the task list, in which
+   case nothing has been done. */
+OSO_INTERNAL int
+oso_impl_sortparallel(struct oso_sortitem *a, size_t n) {
+  size_t const want = OSO_POOL_PARTS * 4;
+  struct oso_sorttask *tasks = malloc((want + 2) * sizeof(struct oso_sorttask));
+  size_t count = 1, i, big, lt, gt;
+  if (!tasks) return 1;
+  tasks[0].a = a;
+  tasks[0].n = n;
+  tasks[0].depth = 0;
+  while (count < want) {
+    struct oso_sorttask t;
+    for (big = 0, i = 1; i < count; i++)
+      if (tasks[i].n > tasks[big].n) big = i;
+    t = tasks[big];
+    if (t.n < OSO_PARALLEL_SORT_MIN / want) break;
+    tasks[big] = tasks[--count];
+    if (oso_impl_sortpartition(t.a, t.n, &lt, &gt) && gt - lt > 1) {
+      oso_impl_sortload(t.a + lt, gt - lt, t.depth + sizeof(size_t));
+      tasks[count].a = t.a + lt;
+      tasks[count].n = gt - lt;
+      tasks[count++].depth = t.depth + sizeof(size_t);
+    }
+    if (lt > 1) {
+      tasks[count].a = t.a;
+      tasks[count].n = lt;
+      tasks[count++].depth = t.depth;
+    }
+    if (t.n - gt > 1) {
+      tasks[count].a = t.a + gt;
+      tasks[count].n = t.n - gt;
+      tasks[count++].depth = t.depth;
+    }
+    if (!count) break;
+  }
+  qsort(tasks, count, sizeof(struct oso_sorttask), oso_impl_sorttaskcmp);
+  oso_impl_parallel(oso_impl_sorttaskrun, tasks, count);
+  free(tasks);
+  return 0;
+}
+
+static int
+oso_impl_qsortcmp(void const *a, void const *b) {
+  return osocmp(*(oso *const *)a, *(oso *const *)b);
+}
+
+void
+ososort(oso **arr, size_t n) {
+  struct oso_sortitem *items;
+  size_t i;
+  if (n < 2) return;
+  items = n <= ((size_t)-1) / sizeof(struct oso_sortitem)
+            ? malloc(n * sizeof(struct oso_sortitem))
+            : NULL;
+  if (!items) {
+    /* Still sort correctly if we can't get the scratch memory. */
+    qsort(arr, n, sizeof(oso *), oso_impl_qsortcmp);
+    return;
+  }
+  for (i = 0; i < n; i++) items[i].s = arr[i];
+  oso_impl_sortload(items, n, 0);
+  if (OSO_POOL_PARTS < 2 || n < OSO_PARALLEL_SORT_MIN ||
+      oso_impl_sortparallel(items, n))
+    oso_impl_sortrange(items, n, 0);
+  for (i = 0; i < n; i++) arr[i] = items[i].s;
+  free(items);
+}
+
+/* Flips the case bit of every byte in the range [first, last]. Bytes that are
+   negative as signed chars are never in range, so non-ASCII is untouched. */
+OSO_INTERNAL void
+oso_impl_casemap(char *str, size_t len, char first, char last) {
+  size_t i = 0;
+#if defined(OSO_AVX2)
+  __m256i const lo32 = _mm256_set1_epi8((char)(first - 1));
+  __m256i const hi32 = _mm256_set1_epi8((char)(last + 1));
+  __m256i const bit32 = _mm256_set1_epi8(0x20);
+  for (; len - i >= 32; i += 32) {
+    __m256i x = _mm256_loadu_si256((__m256i const *)(str + i));
+    __m256i m = _mm256_and_si256(
+      _mm256_cmpgt_epi8(x, lo32), _mm256_cmpgt_epi8(hi32, x));
+    x = _mm256_xor_si256(x, _mm256_and_si256(m, bit32));
+    _mm256_storeu_si256((__m256i *)(str + i), x);
+  }
+#endif
+#if defined(OSO_SSE2)
+  {
+    __m128i const lo = _mm_set1_epi8((char)(first - 1));
+    __m128i const hi = _mm_set1_epi8((char)(last + 1));
+    __m128i const bit = _mm_set1_epi8(0x20);
+    for (; len - i >= 16; i += 16) {
+      __m128i x = _mm_loadu_si128((__m128i const *)(str + i));
+      __m128i m = _mm_and_si128(_mm_cmpgt_epi8(x, lo), _mm_cmplt_epi8(x, hi));
+      x = _mm_xor_si128(x, _mm_and_si128(m, bit));
+      _mm_storeu_si128((__m128i *)(str + i), x);
+    }
+  }
+#endif
+  /* Eight at a time in a 64-bit word, for the tail and for short strings
+     like header names. A byte's top bit ends up set in `in` if it's ASCII
+     and in the range. */
+  for (; len - i >= 8; i += 8) {
+    oso_u64 const ones = OSO_U64(0x01010101, 0x01010101), high = ones * 0x80;
+    oso_u64 x, low, in;
+    memcpy(&x, str + i, 8);
+    low = x & ~high;
+    in = (low + ones * (oso_u64)(0x80 - first)) &
+         ~(low + ones * (oso_u64)(0x7F - last)) & ~x & high;
+    x ^= in >> 2;
+    memcpy(str + i, &x, 8);
+  }
+  for (; i < len; i++) {
+    unsigned char c = (unsigned char)str[i];
+    str[i] = (char)(c ^ ((unsigned char)(c - first) <=
+                         (unsigned char)(last - first)) << 5);
+  }
+}
+
+static int
+oso_impl_lower(int c) {
+  return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+/* Returns the index of the first byte that differs between `a` and `b` when
+   ASCII letters are compared case-insensitively, or `len` if none do. */
+OSO_INTERNAL size_t
+oso_impl_casemismatch(unsigned char const *a, unsigned char const *b,
+                      size_t len) {
+  size_t i = 0;
+#if defined(OSO_SSE2)
+  __m128i const lo = _mm_set1_epi8('A' - 1), hi = _mm_set1_epi8('Z' + 1);
+  __m128i const bit = _mm_set1_epi8(0x20);
+  for (; len - i >= 16; i += 16) {
+    __m128i x = _mm_loadu_si128((__m128i const *)(a + i));
+    __m128i y = _mm_loadu_si128((__m128i const *)(b + i));
+    int mask;
+    x = _mm_or_si128(x, _mm_and_si128(bit,
+      _mm_and_si128(_mm_cmpgt_epi8(x, lo), _mm_cmplt_epi8(x, hi))));
+    y = _mm_or_si128(y, _mm_and_si128(bit,
+      _mm_and_si128(_mm_cmpgt_epi8(y, lo), _mm_cmplt_epi8(y, hi))));
+    mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+    if (mask != 0xFFFF) {
+      while (mask & 1) {
+        mask >>= 1;
+        i++;
+      }
+      return i;
+    }
+  }
+#endif
+  for (; i < len; i++)
+    if (oso_impl_lower(a[i]) != oso_impl_lower(b[i])) break;
+  return i;
+}
+
+void
+osotolower(oso *s) {
+  if (!s) return;
+  OSO_DIRTY(OSO_HDR(s));
+  oso_impl_casemap((char *)s, OSO_HDR(s)->len, 'A', 'Z');
+}
+
+void
+osotoupper(oso *s) {
+  if (!s) return;
+  OSO_DIRTY(OSO_HDR(s));
+  oso_impl_casemap((char *)s, OSO_HDR(s)->len, 'a', 'z');
+}
+
+int
+osocaseeq(oso const *a, oso const *b) {
+  size_t len = osolen(a);
+  if (len != osolen(b)) return 0;
+  if (!len) return 1;
+  return oso_impl_casemismatch((unsigned char const *)a,
+           (unsigned char const *)b, len) == len;
+}
+
+int
+osocasecmp(oso const *a, oso const *b) {
+  size_t alen = osolen(a), blen = osolen(b), len, i;
+  len = alen < blen ? alen : blen;
+  i = len ? oso_impl_casemismatch(
+              (unsigned char const *)a, (unsigned char const *)b, len)
+          : 0;
+  if (i < len)
+    return oso_impl_lower(((unsigned char const *)a)[i]) -
+           oso_impl_lower(((unsigned char const *)b)[i]);
+  return alen < blen ? -1 : alen > blen;
+}
+
+#ifndef OSO_ROPE_LEAF_MAX
+#define OSO_ROPE_LEAF_MAX 2048
+#endif
+
+/* Internal nodes have null `leaf` and two non-null children. Leaf nodes have
+   a non-empty `leaf` and no children. */
+struct oso_rope {
+  struct oso_rope *left, *right;
+  oso *leaf;
+  size_t len;
+  int height;
+};
+
+static int
+oso_impl_ropeheight(oso_rope const *n) {
+  return n ? n->height : 0;
+}
+
+OSO_INTERNAL void
+oso_impl_ropefix(oso_rope *n) {
+  int hl = n->left->height, hr = n->right->height;
+  n->len = n->left->len + n->right->len;
+  n->height = 1 + (hl > hr ? hl : hr);
+}
+
+OSO_INTERNAL oso_rope *
+oso_impl_roperotl(oso_rope *n) {
+  oso_rope *r = n->right;
+  n->right = r->left;
+  oso_impl_ropefix(n);
+  r->left = n;
+  oso_impl_ropefix(r);
+  return r;
+}
+
+OSO_INTERNAL oso_rope *
+oso_impl_roperotr(oso_rope *n) {
+  oso_rope *l = n->left;
+  n->left = l->right;
+  oso_impl_ropefix(n);
+  l->right = n;
+  oso_impl_ropefix(l);
+  return l;
+}
+
+OSO_INTERNAL oso_rope *
+oso_impl_roperebalance(oso_rope *n) {
+  int bal = oso_impl_ropeheight(n->left) - oso_impl_ropeheight(n->right);
+  if (bal > 1) {
+    if (oso_impl_ropeheight(n->left->left) <
+        oso_impl_ropeheight(n->left->right))
+      n->left = oso_impl_roperotl(n->left);
+    return oso_impl_roperotr(n);
+  }
+  if (bal < -1) {
+    if (oso_impl_ropeheight(n->right->right) <
+        oso_impl_ropeheight(n->right->left))
+      n->right = oso_impl_roperotr(n->right);
+    return oso_impl_roperotl(n);
+  }
+  oso_impl_ropefix(n);
+  return n;
+}
+
+static void
+oso_impl_ropefree(oso_rope *n) {
+  if (!n) return;
+  oso_impl_ropefree(n->left);
+  oso_impl_ropefree(n->right);
+  osofree(n->leaf);
+  free(n);
+}
+
+/* Spare nodes and leaf strings for an edit. The nodes that a split takes
+   apart are put here, and the joins after it take them back, so a split
+   needs no new nodes beyond the one for the leaf it cuts in two. With
+   OSO_KEEP_ON_ALLOC_FAILURE, an edit fills this with everything it can need
+   before it touches the tree, so it can't run out of memory halfway through
+   and has nothing to undo. */
+struct oso_ropestash {
+  oso_rope *nodes; /* linked through `left` */
+  oso *leaves[2];
+};
+
+static oso_rope *
+oso_impl_ropenode(struct oso_ropestash *st) {
+  oso_rope *n = st->nodes;
+  if (!n) return malloc(sizeof(oso_rope));
+  st->nodes = n->left;
+  return n;
+}
+
+static void
+oso_impl_ropeunnode(struct oso_ropestash *st, oso_rope *n) {
+  n->left = st->nodes;
+  st->nodes = n;
+}
+
+#if defined(OSO_KEEP_ON_ALLOC_FAILURE)
+/* Sets aside `nodes` nodes and `leaves` leaf strings big enough for any leaf,
+   since a leaf is never longer than OSO_ROPE_LEAF_MAX. */
+OSO_INTERNAL int
+oso_impl_ropereserve(struct oso_ropestash *st, int nodes, int leaves) {
+  int i;
+  for (i = 0; i < nodes; i++) {
+    oso_rope *n = malloc(sizeof(oso_rope));
+    if (!n) return 0;
+    oso_impl_ropeunnode(st, n);
+  }
+  for (i = 0; i < leaves; i++)
+    if (!osoensurecap(&st->leaves[i], OSO_ROPE_LEAF_MAX)) return 0;
+  return 1;
+}
+#endif
+
+static void
+oso_impl_ropeunstash(struct oso_ropestash *st) {
+  while (st->nodes) free(oso_impl_ropenode(st));
+  osofree(st->leaves[0]);
+  osofree(st->leaves[1]);
+}
+
+OSO_INTERNAL oso_rope *
+oso_impl_ropeleaf(struct oso_ropestash *st, char const *cstr, size_t len) {
+  oso_rope *n = oso_impl_ropenode(st);
+  oso *leaf = st->leaves[0];
+  st->leaves[0] = st->leaves[1];
+  st->leaves[1] = NULL;
+  if (!n || !osoputlen(&leaf, cstr, len)) {
+    free(n);
+    osofree(leaf);
+    return NULL;
+  }
+  n->left = n->right = NULL;
+  n->leaf = leaf;
+  n->len = len;
+  n->height = 1;
+  return n;
+}
+
+/* Tries to fold a small leaf into the nearest leaf on the inside edge of the
+   other tree, so that repeated small edits don't leave behind a rope made of
+   tiny fragments. Returns 1 if it was absorbed, 0 if it didn't fit, and -1 on
+   allocation failure (in which case `n` is left holding a null leaf.) With
+   OSO_KEEP_ON_ALLOC_FAILURE, a failure keeps the leaf and returns 0. */
+OSO_INTERNAL int
+oso_impl_ropeabsorb(oso_rope *n, oso_rope const *small, int at_end) {
+  oso_rope *m = n;
+  oso *leaf;
+  size_t len;
+  while (!m->leaf) m = at_end ? m->right : m->left;
+  len = m->len;
+  if (len + small->len > OSO_ROPE_LEAF_MAX) return 0;
+  leaf = m->leaf;
+  if (!osomakeroomfor(&leaf, small->len)) {
+    m->leaf = leaf;
+    return leaf ? 0 : -1;
+  }
+  m->leaf = leaf;
+  if (at_end) {
+    memcpy((char *)leaf + len, (char const *)small->leaf, small->len);
+  } else {
+    memmove((char *)leaf + small->len, (char const *)leaf, len);
+    memcpy((char *)leaf, (char const *)small->leaf, small->len);
+  }
+  ((char *)leaf)[len + small->len] = '\0';
+  OSO_HDR(leaf)->len = len + small->len;
+  OSO_DIRTY(OSO_HDR(leaf));
+  for (m = n; m; m = m->leaf ? NULL : at_end ? m->right : m->left)
+    m->len += small->len;
+  return 1;
+}
+
+/* Concatenates two trees, using at most one new node. Consumes both of them.
+   Returns null only on allocation failure, in which case both trees have
+   been freed. */
+OSO_INTERNAL oso_rope *
+oso_impl_ropejoin(struct oso_ropestash *st, oso_rope *l, oso_rope *r) {
+  oso_rope *n;
+  int hl, hr, absorbed = 0;
+  if (!l) return r;
+  if (!r) return l;
+  if (r->leaf) absorbed = oso_impl_ropeabsorb(l, r, 1);
+  else if (l->leaf) absorbed = oso_impl_ropeabsorb(r, l, 0);
+  if (absorbed) {
+    n = r->leaf ? l : r;
+    oso_impl_ropefree(n == l ? r : l);
+    if (absorbed > 0) return n;
+    oso_impl_ropefree(n);
+    return NULL;
+  }
+  hl = l->height;
+  hr = r->height;
+  if (hl > hr + 1) {
+    n = oso_impl_ropejoin(st, l->right, r);
+    l->right = n;
+    if (!n) {
+      oso_impl_ropefree(l);
+      return NULL;
+    }
+    return oso_impl_roperebalance(l);
+  }
+  if (hr > hl + 1) {
+    n = oso_impl_ropejoin(st, l, r->left);
+    r->left = n;
+    if (!n) {
+      oso_impl_ropefree(r);
+      return NULL;
+    }
+    return oso_impl_roperebalance(r);
+  }
+  n = oso_impl_ropenode(st);
+  if (!n) {
+    oso_impl_ropefree(l);
+    oso_impl_ropefree(r);
+    return NULL;
+  }
+  n->left = l;
+  n->right = r;
+  n->leaf = NULL;
+  oso_impl_ropefix(n);
+  return n;
+}
+
+/* Splits a tree into the characters before `pos` and the characters at and
+   after `pos`. Consumes the tree. Needs one new node and leaf string if `pos`
+   falls inside a leaf. Returns non-zero on allocation failure, in which case
+   everything has been freed. */
+OSO_INTERNAL int
+oso_impl_ropesplit(struct oso_ropestash *st, oso_rope *n, size_t pos,
+                   oso_rope **out_l, oso_rope **out_r) {
+  oso_rope *l, *r, *a, *b;
+  *out_l = *out_r = NULL;
+  if (!n) return 0;
+  if (pos == 0) {
+    *out_r = n;
+    return 0;
+  }
+  if (pos >= n->len) {
+    *out_l = n;
+    return 0;
+  }
+  if (n->leaf) {
+    r = oso_impl_ropeleaf(st, (char const *)n->leaf + pos, n->len - pos);
+    if (!r) {
+      oso_impl_ropefree(n);
+      return 1;
+    }
+    OSO_HDR(n->leaf)->len = pos;
+    OSO_DIRTY(OSO_HDR(n->leaf));
+    ((char *)n->leaf)[pos] = '\0';
+    n->len = pos;
+    *out_l = n;
+    *out_r = r;
+    return 0;
+  }
+  l = n->left;
+  r = n->right;
+  oso_impl_ropeunnode(st, n);
+  if (pos < l->len) {
+    if (oso_impl_ropesplit(st, l, pos, &a, &b)) {
+      oso_impl_ropefree(r);
+      return 1;
+    }
+    b = oso_impl_ropejoin(st, b, r);
+    if (!b) {
+      oso_impl_ropefree(a);
+      return 1;
+    }
+  } else {
+    if (oso_impl_ropesplit(st, r, pos - l->len, &a, &b)) {
+      oso_impl_ropefree(l);
+      return 1;
+    }
+    a = oso_impl_ropejoin(st, l, a);
+    if (!a) {
+      oso_impl_ropefree(b);
+      return 1;
+    }
+  }
+  *out_l = a;
+  *out_r = b;
+  return 0;
+}
+
+/* Builds a new tree, without touching any other. */
+OSO_INTERNAL oso_rope *
+oso_impl_ropebuild(struct oso_ropestash *st, char const *cstr, size_t len) {
+  size_t half;
+  oso_rope *l, *r;
+  if (len <= OSO_ROPE_LEAF_MAX) return oso_impl_ropeleaf(st, cstr, len);
+  half = (len / OSO_ROPE_LEAF_MAX + 1) / 2 * OSO_ROPE_LEAF_MAX;
+  l = oso_impl_ropebuild(st, cstr, half);
+  if (!l) return NULL;
+  r = oso_impl_ropebuild(st, cstr + half, len - half);
+  if (!r) {
+    oso_impl_ropefree(l);
+    return NULL;
+  }
+  return oso_impl_ropejoin(st, l, r);
+}
+
+/* Applies the alloc failure rule to a rope. */
+static int
+oso_impl_ropefail(oso_rope **p, struct oso_ropestash *st) {
+  oso_impl_ropeunstash(st);
+#if defined(OSO_KEEP_ON_ALLOC_FAILURE)
+  (void)p;
+#else
+  oso_impl_ropefree(*p);
+  *p = NULL;
+#endif
+  return 0;
+}
+
+int
+osoropeinsert(oso_rope **p, size_t pos, char const *cstr, size_t len) {
+  struct oso_ropestash st = {NULL, {NULL, NULL}};
+  oso_rope *mid, *a, *b;
+  if (!len) return 1;
+  mid = oso_impl_ropebuild(&st, cstr, len);
+  if (!mid) return oso_impl_ropefail(p, &st);
+#if defined(OSO_KEEP_ON_ALLOC_FAILURE)
+  /* A leaf for the split, and a node for each of the two joins. */
+  if (!oso_impl_ropereserve(&st, 3, 1)) {
+    oso_impl_ropefree(mid);
+    return oso_impl_ropefail(p, &st);
+  }
+#endif
+  if (oso_impl_ropesplit(&st, *p, pos, &a, &b)) {
+    oso_impl_ropefree(mid);
+    *p = NULL;
+    return oso_impl_ropefail(p, &st);
+  }
+  a = oso_impl_ropejoin(&st, a, mid);
+  if (!a) {
+    oso_impl_ropefree(b);
+    *p = NULL;
+    return oso_impl_ropefail(p, &st);
+  }
+  *p = oso_impl_ropejoin(&st, a, b);
+  oso_impl_ropeunstash(&st);
+  return *p != NULL;
+}
+
+int
+osoropeerase(oso_rope **p, size_t pos, size_t len) {
+  struct oso_ropestash st = {NULL, {NULL, NULL}};
+  oso_rope *a, *mid, *b;
+  if (!len) return 1;
+#if defined(OSO_KEEP_ON_ALLOC_FAILURE)
+  /* A leaf for each of the two splits, and a node for the join. */
+  if (!oso_impl_ropereserve(&st, 3, 2)) return oso_impl_ropefail(p, &st);
+#endif
+  if (oso_impl_ropesplit(&st, *p, pos, &a, &b)) {
+    *p = NULL;
+    return oso_impl_ropefail(p, &st);
+  }
+  if (oso_impl_ropesplit(&st, b, len, &mid, &b)) {
+    oso_impl_ropefree(a);
+    *p = NULL;
+    return oso_impl_ropefail(p, &st);
+  }
+  oso_impl_ropefree(mid);
+  *p = oso_impl_ropejoin(&st, a, b);
+  oso_impl_ropeunstash(&st);
+  return *p || !a || !b;
+}
+
+int
+osoropecat(oso_rope **p, oso_rope *other) {
+  struct oso_ropestash st = {NULL, {NULL, NULL}};
+  int empty = !*p || !other;
+#if defined(OSO_KEEP_ON_ALLOC_FAILURE)
+  if (!empty && !oso_impl_ropereserve(&st, 1, 0))
+    return oso_impl_ropefail(p, &st);
+#endif
+  *p = oso_impl_ropejoin(&st, *p, other);
+  oso_impl_ropeunstash(&st);
+  return *p || empty;
+}
+
+int
+osoropeeach(oso_rope const *r,
+            int (*fn)(char const *chunk, size_t len, void *user), void *user) {
+  int res;
+  if (!r) return 0;
+  if (r->leaf) return fn((char const *)r->leaf, r->len, user);
+  res = osoropeeach(r->left, fn, user);
+  if (res) return res;
+  return osoropeeach(r->right, fn, user);
+}
+
+size_t
+osoropelen(oso_rope const *r) {
+  return r ? r->len : 0;
+}
+
+void
+osoropefree(oso_rope *r) {
+  oso_impl_ropefree(r);
+}
+
+static int
+oso_impl_ropecopycb(char const *chunk, size_t len, void *user) {
+  char **dst = (char **)user;
+  memcpy(*dst, chunk, len);
+  *dst += len;
+  return 0;
+}
+
+int
+osoputrope(oso **p, oso_rope const *r) {
+  size_t len = osoropelen(r);
+  char *dst;
+  if (!osoensurecap(p, len)) return 0;
+  dst = (char *)*p;
+  osoropeeach(r, oso_impl_ropecopycb, &dst);
+  *dst = '\0';
+  OSO_HDR(*p)->len = len;
+  OSO_DIRTY(OSO_HDR(*p));
+  return 1;
+}
+
+int
+osocatrope(oso **p, oso_rope const *r) {
+  size_t len = osoropelen(r);
+  oso_header *hdr;
+  char *dst;
+  if (!osomakeroomfor(p, len)) return 0;
+  hdr = OSO_HDR(*p);
+  dst = (char *)*p + hdr->len;
+  osoropeeach(r, oso_impl_ropecopycb, &dst);
+  *dst = '\0';
+  hdr->len += len;
+  OSO_DIRTY(hdr);
+  return 1;
+}
+
+/* The map is a SwissTable-style open addressing table. Each slot has a
+   control byte: either OSO_MAP_EMPTY, OSO_MAP_DELETED, or the low 7 bits of
+   the key's hash if the slot is full. Slots are probed in aligned groups of
+   16, and all of the control bytes in a group are checked at once. */
+#define OSO_MAP_GROUP 16
+#define OSO_MAP_EMPTY 0x80
+#define OSO_MAP_DELETED 0xFE
+
+struct oso_mapslot {
+  oso *key;
+  void *value;
+};
+
+struct oso_map {
+  size_t len, cap, growth_left;
+  struct oso_mapslot *slots;
+  unsigned char *ctrl;
+};
+
+static unsigned
+oso_impl_ctz(unsigned x) {
+#if defined(__GNUC__) || defined(__clang__)
+  return (unsigned)__builtin_ctz(x);
+#else
+  unsigned n = 0;
+  while (!(x & 1)) {
+    x >>= 1;
+    n++;
+  }
+  return n;
+#endif
+}
+
+/* Bit i of the result is set if control byte i of the group equals `c`. */
+static unsigned
+oso_impl_mapmatch(unsigned char const *group, unsigned char c) {
+#if defined(OSO_SSE2)
+  __m128i g = _mm_loadu_si128((__m128i const *)group);
+  return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)c)));
+#else
+  unsigned i, bits = 0;
+  for (i = 0; i < OSO_MAP_GROUP; i++) bits |= (unsigned)(group[i] == c) << i;
+  return bits;
+#endif
+}
+
+/* Bit i of the result is set if slot i of the group is empty or deleted. */
+static unsigned
+oso_impl_mapfree(unsigned char const *group) {
+#if defined(OSO_SSE2)
+  return (unsigned)_mm_movemask_epi8(
+    _mm_loadu_si128((__m128i const *)group));
+#else
+  unsigned i, bits = 0;
+  for (i = 0; i < OSO_MAP_GROUP; i++) bits |= (unsigned)(group[i] >> 7) << i;
+  return bits;
+#endif
+}
+
+/* Returns the index of the slot holding the key, or `m->cap` if there isn't
+   one. */
+OSO_INTERNAL size_t
+oso_impl_mapfind(oso_map const *m, char const *key, size_t len, oso_u64 hash) {
+  size_t mask, g, step = 0;
+  unsigned char h2 = (unsigned char)(hash & 0x7F);
+  if (!m || !m->cap) return m ? m->cap : 0;
+  mask = m->cap / OSO_MAP_GROUP - 1;
+  g = (size_t)(hash >> 7) & mask;
+  for (;;) {
+    unsigned char const *group = m->ctrl + g * OSO_MAP_GROUP;
+    unsigned bits = oso_impl_mapmatch(group, h2);
+    while (bits) {
+      size_t i = g * OSO_MAP_GROUP + oso_impl_ctz(bits);
+      oso const *k = m->slots[i].key;
+      if (OSO_HDR(k)->len == len && memcmp(k, key, len) == 0) return i;
+      bits &= bits - 1;
+    }
+    if (oso_impl_mapmatch(group, OSO_MAP_EMPTY)) return m->cap;
+    g = (g + ++step) & mask;
+  }
+}
+
+/* Returns the index of the first empty or deleted slot on the probe sequence
+   for `hash`. The map must have room. */
+OSO_INTERNAL size_t
+oso_impl_mapslotfor(oso_map const *m, oso_u64 hash) {
+  size_t mask = m->cap / OSO_MAP_GROUP - 1, step = 0;
+  size_t g = (size_t)(hash >> 7) & mask;
+  for (;;) {
+    unsigned bits = oso_impl_mapfree(m->ctrl + g * OSO_MAP_GROUP);
+    if (bits) return g * OSO_MAP_GROUP + oso_impl_ctz(bits);
+    g = (g + ++step) & mask;
+  }
+}
+
+static void
+oso_impl_mapdestroy(oso_map *m) {
+  size_t i;
+  if (!m) return;
+  for (i = 0; i < m->cap; i++)
+    if (m->ctrl[i] < OSO_MAP_EMPTY) osofree(m->slots[i].key);
+  free(m->slots);
+  free(m);
+}
+
+/* Moves every entry into a new table with `new_cap` slots. Returns non-zero
+   on allocation failure, in which case the map is left as it was. */
+OSO_INTERNAL int
+oso_impl_maprehash(oso_map *m, size_t new_cap) {
+  struct oso_mapslot *slots, *old_slots = m->slots;
+  unsigned char *old_ctrl = m->ctrl;
+  size_t i, old_cap = m->cap;
+  if (new_cap > ((size_t)-1) / (sizeof(struct oso_mapslot) + 1)) return 1;
+  slots = malloc(new_cap * (sizeof(struct oso_mapslot) + 1));
+  if (!slots) return 1;
+  m->slots = slots;
+  m->ctrl = (unsigned char *)(slots + new_cap);
+  m->cap = new_cap;
+  m->growth_left = new_cap - new_cap / 8 - m->len;
+  memset(m->ctrl, OSO_MAP_EMPTY, new_cap);
+  for (i = 0; i < old_cap; i++) {
+    oso_u64 hash;
+    size_t j;
+    if (old_ctrl[i] >= OSO_MAP_EMPTY) continue;
+    hash = osohash(old_slots[i].key);
+    j = oso_impl_mapslotfor(m, hash);
+    m->ctrl[j] = (unsigned char)(hash & 0x7F);
+    m->slots[j] = old_slots[i];
+  }
+  free(old_slots);
+  return 0;
+}
+
+/* Smallest table size that can hold `count` entries at 7/8 load. */
+static size_t
+oso_impl_mapcapfor(size_t count) {
+  size_t cap = OSO_MAP_GROUP;
+  while (cap - cap / 8 < count) {
+    if (cap > ((size_t)-1) / 2) return 0;
+    cap *= 2;
+  }
+  return cap;
+}
+
+OSO_INTERNAL oso_map *
+oso_impl_mapnew(void) {
+  oso_map *m = malloc(sizeof(oso_map));
+  if (!m) return NULL;
+  m->len = m->cap = m->growth_left = 0;
+  m->slots = NULL;
+  m->ctrl = NULL;
+  return m;
+}
+
+void **
+osomapset(oso_map **p, oso *key) {
+  oso_map *m = *p;
+  oso_u64 hash = osohash(key);
+  size_t len = osolen(key), i;
+  unsigned char ctrl;
+  if (!key) osoputlen(&key, "", 0);
+  if (!m) m = oso_impl_mapnew();
+  if (m && key) {
+    i = oso_impl_mapfind(m, (char const *)key, len, hash);
+    if (i < m->cap) {
+      osofree(key);
+      return &m->slots[i].value;
+    }
+    if (!m->growth_left) {
+      size_t new_cap = m->cap;
+      if (m->len >= (m->cap - m->cap / 8) / 2)
+        new_cap = new_cap ? new_cap * 2 : OSO_MAP_GROUP;
+      /* If this fails, there's still no room, and we give up below. */
+      if (new_cap) oso_impl_maprehash(m, new_cap);
+    }
+    if (m->growth_left) {
+      i = oso_impl_mapslotfor(m, hash);
+      ctrl = m->ctrl[i];
+      m->ctrl[i] = (unsigned char)(hash & 0x7F);
+      m->slots[i].key = key;
+      m->slots[i].value = NULL;
+      m->len++;
+      if (ctrl == OSO_MAP_EMPTY) m->growth_left--;
+      *p = m;
+      return &m->slots[i].value;
+    }
+  }
+  osofree(key);
+#if defined(OSO_KEEP_ON_ALLOC_FAILURE)
+  if (m != *p) oso_impl_mapdestroy(m);
+#else
+  oso_impl_mapdestroy(m);
+  *p = NULL;
+#endif
+  return NULL;
+}
+
+void **
+osomapget(oso_map const *m, oso const *key) {
+  size_t i = oso_impl_mapfind(m, key ? (char const *)key : "", osolen(key),
+    osohash(key));
+  return m && i < m->cap ? &m->slots[i].value : NULL;
+}
+
+void **
+osomapgetlen(oso_map const *m, char const *cstr, size_t len) {
+  size_t i = oso_impl_mapfind(m, cstr, len, oso_impl_hash(cstr, len));
+  return m && i < m->cap ? &m->slots[i].value : NULL;
+}
+
+int
+osomaperase(oso_map *m, oso const *key) {
+  size_t i = oso_impl_mapfind(m, key ? (char const *)key : "", osolen(key),
+    osohash(key));
+  size_t g;
+  if (!m || i >= m->cap) return 0;
+  osofree(m->slots[i].key);
+  /* If the group still has an empty slot, no probe sequence ever continued
+     past it, so this slot can go straight back to empty. */
+  g = i - i % OSO_MAP_GROUP;
+  if (oso_impl_mapmatch(m->ctrl + g, OSO_MAP_EMPTY)) {
+    m->ctrl[i] = OSO_MAP_EMPTY;
+    m->growth_left++;
+  } else {
+    m->ctrl[i] = OSO_MAP_DELETED;
+  }
+  m->len--;
+  return 1;
+}
+
+int
+osomapreserve(oso_map **p, size_t count) {
+  oso_map *m = *p;
+  size_t cap = oso_impl_mapcapfor(count);
+  if (!cap) return 0;
+  if (m) return m->cap >= cap || !oso_impl_maprehash(m, cap);
+  m = oso_impl_mapnew();
+  if (!m) return 0;
+  if (oso_impl_maprehash(m, cap)) {
+    oso_impl_mapdestroy(m);
+    return 0;
+  }
+  *p = m;
+  return 1;
+}
+
+size_t
+osomaplen(oso_map const *m) {
+  return m ? m->len : 0;
+}
+
+int
+osomapnext(oso_map const *m, size_t *iter, oso const **out_key,
+           void **out_value) {
+  size_t i;
+  if (!m) return 0;
+  for (i = *iter; i < m->cap; i++) {
+    if (m->ctrl[i] >= OSO_MAP_EMPTY) continue;
+    *iter = i + 1;
+    if (out_key) *out_key = m->slots[i].key;
+    if (out_value) *out_value = m->slots[i].value;
+    return 1;
+  }
+  *iter = m->cap;
+  return 0;
+}
+
+void
+osomapfree(oso_map *m) {
+  oso_impl_mapdestroy(m);
+}
+
+/* A vec keeps every element in one oso buffer, each followed by a null
+   terminator. `offs` has `count + 1` entries: where each element starts,
+   and then where the next one would start. */
+struct oso_vec {
+  size_t count, offs_cap;
+  size_t *offs;
+  oso *buf;
+};
+
+static void
+oso_impl_vecdestroy(oso_vec *v) {
+  if (!v) return;
+  free(v->offs);
+  osofree(v->buf);
+  free(v);
+}
+
+/* Grows the offsets table and the buffer so that `add_count` more elements
+   with `add_bytes` more characters in total will fit. Returns non-zero on
+   allocation failure. */
+OSO_INTERNAL int
+oso_impl_vecroom(oso_vec *v, size_t add_count, size_t add_bytes) {
+  size_t need_offs = v->count + add_count + 1, need_bytes, len, cap;
+  if (need_offs < add_count) return 1;
+  if (need_offs > v->offs_cap) {
+    size_t new_cap = v->offs_cap * 2, *offs;
+    if (new_cap < need_offs) new_cap = need_offs < 8 ? 8 : need_offs;
+    if (new_cap > ((size_t)-1) / sizeof(size_t)) return 1;
+    offs = realloc(v->offs, new_cap * sizeof(size_t));
+    if (!offs) return 1;
+    if (!v->offs) offs[0] = 0;
+    v->offs = offs;
+    v->offs_cap = new_cap;
+  }
+  osolencap(v->buf, &len, &cap);
+  need_bytes = add_bytes + add_count;
+  if (need_bytes < add_bytes || len > ((size_t)-1) - need_bytes) return 1;
+  need_bytes += len;
+  if (need_bytes > cap || !v->buf)
+    return !osoensurecap(&v->buf, need_bytes > cap * 2 ? need_bytes : cap * 2);
+  return 0;
+}
+
+/* Like `oso_impl_vecroom()`, but creates the vec if it's null, and applies
+   the alloc failure rule if an allocation fails. A failed room check leaves
+   the elements as they were, only with a bigger offsets table, so the vec can
+   be kept. */
+OSO_INTERNAL int
+oso_impl_vecgrow(oso_vec **p, size_t add_count, size_t add_bytes) {
+  oso_vec *v = *p;
+  if (!v) {
+    v = malloc(sizeof(oso_vec));
+    if (!v) return 1;
+    v->count = v->offs_cap = 0;
+    v->offs = NULL;
+    v->buf = NULL;
+  }
+  if (oso_impl_vecroom(v, add_count, add_bytes)) {
+#if defined(OSO_KEEP_ON_ALLOC_FAILURE)
+    if (v != *p) oso_impl_vecdestroy(v);
+#else
+    oso_impl_vecdestroy(v);
+    *p = NULL;
+#endif
+    return 1;
+  }
+  *p = v;
+  return 0;
+}
+
+int
+osovecpushlen(oso_vec **p, char const *cstr, size_t len) {
+  oso_vec *v;
+  oso_header *hdr;
+  size_t end;
+  if (oso_impl_vecgrow(p, 1, len)) return 0;
+  v = *p;
+  hdr = OSO_HDR(v->buf);
+  end = hdr->len;
+  memcpy((char *)v->buf + end, cstr, len);
+  ((char *)v->buf)[end + len] = '\0';
+  hdr->len = end + len + 1;
+  OSO_DIRTY(hdr);
+  v->offs[++v->count] = hdr->len;
+  return 1;
+}
+
+int
+osovecpush(oso_vec **p, char const *cstr) {
+  return osovecpushlen(p, cstr, strlen(cstr));
+}
+
+int
+osovecpushoso(oso_vec **p, oso const *s) {
+  return osovecpushlen(p, s ? (char const *)s : "", osolen(s));
+}
+
+void
+osovecpop(oso_vec *v) {
+  if (!v || !v->count) return;
+  v->count--;
+  OSO_HDR(v->buf)->len = v->offs[v->count];
+  OSO_DIRTY(OSO_HDR(v->buf));
+}
+
+void
+osovecclear(oso_vec *v) {
+  if (!v) return;
+  v->count = 0;
+  osoclear(&v->buf);
+}
+
+int
+osovecreserve(oso_vec **p, size_t count, size_t total_len) {
+  return !oso_impl_vecgrow(p, count, total_len);
+}
+
+size_t
+osoveccount(oso_vec const *v) {
+  return v ? v->count : 0;
+}
+
+char const *
+osovecat(oso_vec const *v, size_t i, size_t *out_len) {
+  size_t start = v->offs[i];
+  if (out_len) *out_len = v->offs[i + 1] - start - 1;
+  return (char const *)v->buf + start;
+}
+
+int
+osovecget(oso **p, oso_vec const *v, size_t i) {
+  size_t len;
+  char const *str = osovecat(v, i, &len);
+  return osoputlen(p, str, len);
+}
+
+void
+osovecfree(oso_vec *v) {
+  oso_impl_vecdestroy(v);
+}
+
+/* Makes room to append `len` characters that might each expand to `factor`
+   characters, and returns where to write them. Returns null if an allocation
+   failed, in which case the alloc failure rule has been applied to `*p`. */
+OSO_INTERNAL char *
+oso_impl_catreserve(oso **p, size_t len, size_t factor) {
+  if (len > OSO_CAP_MAX / factor) {
+    oso_impl_allocfail(p);
+    return NULL;
+  }
+  if (!osomakeroomfor(p, len * factor)) return NULL;
+  return (char *)*p + OSO_HDR(*p)->len;
+}
+
+/* Terminates the string at `end` and updates its length. */
+static void
+oso_impl_catfinish(oso *s, char *end) {
+  *end = '\0';
+  OSO_HDR(s)->len = (size_t)(end - (char *)s);
+  OSO_DIRTY(OSO_HDR(s));
+}
+
+enum { OSO_ESC_JSON, OSO_ESC_HTML, OSO_ESC_URL, OSO_ESC_URLDEC, OSO_ESC_C };
+
+static int
+oso_impl_escneeds(int kind, unsigned char c) {
+  switch (kind) {
+  case OSO_ESC_JSON: return c < 0x20 || c == '"' || c == '\\';
+  case OSO_ESC_HTML:
+    return c == '&' || c == '<' || c == '>' || c == '"' || c == '\'';
+  case OSO_ESC_URL:
+    return !((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+             (c >= '0' && c <= '9') || c == '-' || c == '.' || c == '_' ||
+             c == '~');
+  case OSO_ESC_URLDEC: return c == '%';
+  case OSO_ESC_C: return c < 0x20 || c == 0x7F || c == '"' || c == '\\';
+  }
+  return 0;
+}
+
+/* Returns the length of the run at the start of `str` that doesn't need any
+   escaping, checking 16 characters at a time. */
+OSO_INTERNAL size_t
+oso_impl_escscan(int kind, unsigned char const *str, size_t len) {
+  size_t i = 0;
+#if defined(OSO_SSE2)
+  __m128i const ctl = _mm_set1_epi8(0x1F);
+  for (; len - i >= 16; i += 16) {
+    __m128i x = _mm_loadu_si128((__m128i const *)(str + i)), m;
+    unsigned bits;
+    switch (kind) {
+    case OSO_ESC_JSON:
+    case OSO_ESC_C:
+      m = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(x, ctl), x),
+        _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('"')),
+          _mm_cmpeq_epi8(x, _mm_set1_epi8('\\'))));
+      if (kind == OSO_ESC_C)
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8(0x7F)));
+      break;
+    case OSO_ESC_HTML:
+      m = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('&')),
+          _mm_cmpeq_epi8(x, _mm_set1_epi8('<'))),
+        _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('>')),
+          _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('"')),
+            _mm_cmpeq_epi8(x, _mm_set1_epi8('\'')))));
+      break;
+    case OSO_ESC_URL: {
+      __m128i alpha = _mm_sub_epi8(
+        _mm_or_si128(x, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+      __m128i digit = _mm_sub_epi8(x, _mm_set1_epi8('0'));
+      alpha = _mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8(25)), alpha);
+      digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+      m = _mm_or_si128(_mm_or_si128(alpha, digit),
+        _mm_or_si128(
+          _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('-')),
+            _mm_cmpeq_epi8(x, _mm_set1_epi8('.'))),
+          _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('_')),
+            _mm_cmpeq_epi8(x, _mm_set1_epi8('~')))));
+      m = _mm_xor_si128(m, _mm_set1_epi8(-1));
+      break;
+    }
+    default: m = _mm_cmpeq_epi8(x, _mm_set1_epi8('%')); break;
+    }
+    bits = (unsigned)_mm_movemask_epi8(m);
+    if (bits) return i + oso_impl_ctz(bits);
+  }
+#endif
+  for (; i < len; i++)
+    if (oso_impl_escneeds(kind, str[i])) break;
+  return i;
+}
+
+static char const oso_impl_hexdigits[] = "0123456789ABCDEF";
+
+/* Appends `cstr` to `p`, copying clean runs in bulk and calling `escfn` to
+   write the escaped form of each character that needs it. `factor` is the
+   most characters that `escfn` will write for one input character. */
+OSO_INTERNAL int
+oso_impl_catescaped(oso **p, char const *cstr, size_t len, int kind,
+                    size_t factor, char *(*escfn)(char *out, unsigned char c)) {
+  unsigned char const *src = (unsigned char const *)cstr;
+  char *out = oso_impl_catreserve(p, len, factor);
+  size_t i = 0;
+  if (!out) return 0;
+  for (;;) {
+    size_t run = oso_impl_escscan(kind, src + i, len - i);
+    memcpy(out, src + i, run);
+    out += run;
+    i += run;
+    if (i == len) break;
+    out = escfn(out, src[i++]);
+  }
+  oso_impl_catfinish(*p, out);
+  return 1;
+}
+
+static char *
+oso_impl_jsonesc(char *out, unsigned char c) {
+  *out++ = '\\';
+  switch (c) {
+  case '"': *out++ = '"'; break;
+  case '\\': *out++ = '\\'; break;
+  case '\b': *out++ = 'b'; break;
+  case '\f': *out++ = 'f'; break;
+  case '\n': *out++ = 'n'; break;
+  case '\r': *out++ = 'r'; break;
+  case '\t': *out++ = 't'; break;
+  default:
+    memcpy(out, "u00", 3);
+    out[3] = oso_impl_hexdigits[c >> 4];
+    out[4] = oso_impl_hexdigits[c & 0xF];
+    out += 5;
+    break;
+  }
+  return out;
+}
+
+static char *
+oso_impl_htmlesc(char *out, unsigned char c) {
+  char const *ent;
+  size_t n;
+  switch (c) {
+  case '&': ent = "&amp;"; break;
+  case '<': ent = "&lt;"; break;
+  case '>': ent = "&gt;"; break;
+  case '"': ent = "&quot;"; break;
+  default: ent = "&#39;"; break;
+  }
+  n = strlen(ent);
+  memcpy(out, ent, n);
+  return out + n;
+}
+
+static char *
+oso_impl_urlenc(char *out, unsigned char c) {
+  out[0] = '%';
+  out[1] = oso_impl_hexdigits[c >> 4];
+  out[2] = oso_impl_hexdigits[c & 0xF];
+  return out + 3;
+}
+
+static char *
+oso_impl_cesc(char *out, unsigned char c) {
+  *out++ = '\\';
+  switch (c) {
+  case '"': *out++ = '"'; break;
+  case '\\': *out++ = '\\'; break;
+  case '\a': *out++ = 'a'; break;
+  case '\b': *out++ = 'b'; break;
+  case '\f': *out++ = 'f'; break;
+  case '\n': *out++ = 'n'; break;
+  case '\r': *out++ = 'r'; break;
+  case '\t': *out++ = 't'; break;
+  case '\v': *out++ = 'v'; break;
+  default:
+    /* Always 3 octal digits, so a following digit can't extend it. */
+    out[0] = (char)('0' + (c >> 6));
+    out[1] = (char)('0' + ((c >> 3) & 7));
+    out[2] = (char)('0' + (c & 7));
+    out += 3;
+    break;
+  }
+  return out;
+}
+
+int
+osocatjsonesc(oso **p, char const *cstr, size_t len) {
+  return oso_impl_catescaped(p, cstr, len, OSO_ESC_JSON, 6, oso_impl_jsonesc);
+}
+
+int
+osocathtmlesc(oso **p, char const *cstr, size_t len) {
+  return oso_impl_catescaped(p, cstr, len, OSO_ESC_HTML, 6, oso_impl_htmlesc);
+}
+
+int
+osocaturlenc(oso **p, char const *cstr, size_t len) {
+  return oso_impl_catescaped(p, cstr, len, OSO_ESC_URL, 3, oso_impl_urlenc);
+}
+
+int
+osocatcesc(oso **p, char const *cstr, size_t len) {
+  return oso_impl_catescaped(p, cstr, len, OSO_ESC_C, 4, oso_impl_cesc);
+}
+
+static int
+oso_impl_hexval(unsigned char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  c = (unsigned char)(c | 0x20);
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+int
+osocaturldec(oso **p, char const *cstr, size_t len) {
+  unsigned char const *src = (unsigned char const *)cstr;
+  char *out = oso_impl_catreserve(p, len, 1), *start = out;
+  size_t i = 0;
+  if (!out) return 0;
+  for (;;) {
+    size_t run = oso_impl_escscan(OSO_ESC_URLDEC, src + i, len - i);
+    int hi, lo;
+    memcpy(out, src + i, run);
+    out += run;
+    i += run;
+    if (i == len) break;
+    if (len - i < 3 || (hi = oso_impl_hexval(src[i + 1])) < 0 ||
+        (lo = oso_impl_hexval(src[i + 2])) < 0) {
+      *start = '\0';
+      return 0;
+    }
+    *out++ = (char)(hi << 4 | lo);
+    i += 3;
+  }
+  oso_impl_catfinish(*p, out);
+  return 1;
+}
+
+/* The SIMD base64 kernels are from Wojciech Mula and Daniel Lemire, "Faster
+   Base64 Encoding and Decoding Using AVX2 Instructions", and Alfred Klomp's
+   base64 library. Encoding spreads each 3 input bytes over 4 bytes, splits
+   out the 6-bit values with multiplies, and maps them to ASCII with a
+   16-entry table of offsets. Decoding classifies each character by its
+   nibbles to validate it and find its offset, then packs the 6-bit values
+   back together with multiply-adds. */
+static char const oso_impl_b64digits[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static char const oso_impl_hexlower[] = "0123456789abcdef";
+
+#if defined(OSO_SSSE3)
+#define OSO_B64_ENC_SHUF 1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10
+#define OSO_B64_ENC_LUT                                                  \
+  'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, \
+    '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0
+#define OSO_B64_DEC_LUT_LO                                          \
+  0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, \
+    0x1A, 0x1B, 0x1B, 0x1B, 0x1A
+#define OSO_B64_DEC_LUT_HI                                          \
+  0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, \
+    0x10, 0x10, 0x10, 0x10, 0x10
+#define OSO_B64_DEC_LUT_ROLL \
+  0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0
+#define OSO_B64_DEC_SHUF 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1
+#endif
+
+int
+osocatbase64(oso **p, char const *cstr, size_t len) {
+  unsigned char const *src = (unsigned char const *)cstr;
+  size_t i = 0, out_len;
+  char *out;
+  out_len = len / 3 > (OSO_CAP_MAX - 4) / 4
+              ? (size_t)-1
+              : len / 3 * 4 + (len % 3 ? 4 : 0);
+  out = oso_impl_catreserve(p, out_len, 1);
+  if (!out) return 0;
+#if defined(OSO_AVX2)
+  for (; len - i >= 28; i += 24, out += 32) {
+    __m256i const shuf = _mm256_setr_epi8(OSO_B64_ENC_SHUF, OSO_B64_ENC_SHUF);
+    __m256i const lut = _mm256_setr_epi8(OSO_B64_ENC_LUT, OSO_B64_ENC_LUT);
+    __m256i x = _mm256_inserti128_si256(
+      _mm256_castsi128_si256(_mm_loadu_si128((__m128i const *)(src + i))),
+      _mm_loadu_si128((__m128i const *)(src + i + 12)), 1);
+    __m256i r;
+    x = _mm256_shuffle_epi8(x, shuf);
+    x = _mm256_or_si256(
+      _mm256_mulhi_epu16(_mm256_and_si256(x, _mm256_set1_epi32(0x0FC0FC00)),
+        _mm256_set1_epi32(0x04000040)),
+      _mm256_mullo_epi16(_mm256_and_si256(x, _mm256_set1_epi32(0x003F03F0)),
+        _mm256_set1_epi32(0x01000010)));
+    r = _mm256_subs_epu8(x, _mm256_set1_epi8(51));
+    r = _mm256_or_si256(r, _mm256_and_si256(
+      _mm256_cmpgt_epi8(_mm256_set1_epi8(26), x), _mm256_set1_epi8(13)));
+    r = _mm256_add_epi8(_mm256_shuffle_epi8(lut, r), x);
+    _mm256_storeu_si256((__m256i *)out, r);
+  }
+#endif
+#if defined(OSO_SSSE3)
+  for (; len - i >= 16; i += 12, out += 16) {
+    __m128i const shuf = _mm_setr_epi8(OSO_B64_ENC_SHUF);
+    __m128i const lut = _mm_setr_epi8(OSO_B64_ENC_LUT);
+    __m128i x = _mm_loadu_si128((__m128i const *)(src + i)), r;
+    x = _mm_shuffle_epi8(x, shuf);
+    x = _mm_or_si128(
+      _mm_mulhi_epu16(_mm_and_si128(x, _mm_set1_epi32(0x0FC0FC00)),
+        _mm_set1_epi32(0x04000040)),
+      _mm_mullo_epi16(_mm_and_si128(x, _mm_set1_epi32(0x003F03F0)),
+        _mm_set1_epi32(0x01000010)));
+    r = _mm_subs_epu8(x, _mm_set1_epi8(51));
+    r = _mm_or_si128(r,
+      _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), x), _mm_set1_epi8(13)));
+    r = _mm_add_epi8(_mm_shuffle_epi8(lut, r), x);
+    _mm_storeu_si128((__m128i *)out, r);
+  }
+#endif
+  for (; len - i >= 3; i += 3, out += 4) {
+    unsigned long v = (unsigned long)src[i] << 16 |
+                      (unsigned long)src[i + 1] << 8 | src[i + 2];
+    out[0] = oso_impl_b64digits[v >> 18];
+    out[1] = oso_impl_b64digits[(v >> 12) & 0x3F];
+    out[2] = oso_impl_b64digits[(v >> 6) & 0x3F];
+    out[3] = oso_impl_b64digits[v & 0x3F];
+  }
+  if (len - i) {
+    unsigned long v = (unsigned long)src[i] << 16;
+    if (len - i == 2) v |= (unsigned long)src[i + 1] << 8;
+    out[0] = oso_impl_b64digits[v >> 18];
+    out[1] = oso_impl_b64digits[(v >> 12) & 0x3F];
+    out[2] = len - i == 2 ? oso_impl_b64digits[(v >> 6) & 0x3F] : '=';
+    out[3] = '=';
+    out += 4;
+  }
+  oso_impl_catfinish(*p, out);
+  return 1;
+}
+
+static int
+oso_impl_b64val(unsigned char c) {
+  if (c >= 'A' && c <= 'Z') return c - 'A';
+  if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+  if (c >= '0' && c <= '9') return c - '0' + 52;
+  if (c == '+') return 62;
+  if (c == '/') return 63;
+  return -1;
+}
+
+int
+osocatbase64dec(oso **p, char const *cstr, size_t len) {
+  unsigned char const *src = (unsigned char const *)cstr;
+  size_t i = 0, n = len, out_len;
+  char *out, *start, *end;
+  if (n % 4 == 0 && n && src[n - 1] == '=') n -= src[n - 2] == '=' ? 2 : 1;
+  if (n % 4 == 1) return 0;
+  out_len = n / 4 * 3 + n % 4 * 3 / 4;
+  start = out = oso_impl_catreserve(p, out_len, 1);
+  if (!out) return 0;
+  end = out + out_len;
+#if defined(OSO_AVX2)
+  while (n - i >= 48) {
+    __m256i const lut_lo = _mm256_setr_epi8(
+      OSO_B64_DEC_LUT_LO, OSO_B64_DEC_LUT_LO);
+    __m256i const lut_hi = _mm256_setr_epi8(
+      OSO_B64_DEC_LUT_HI, OSO_B64_DEC_LUT_HI);
+    __m256i const lut_roll = _mm256_setr_epi8(
+      OSO_B64_DEC_LUT_ROLL, OSO_B64_DEC_LUT_ROLL);
+    __m256i const shuf = _mm256_setr_epi8(OSO_B64_DEC_SHUF, OSO_B64_DEC_SHUF);
+    __m256i const m2f = _mm256_set1_epi8(0x2F);
+    __m256i x = _mm256_loadu_si256((__m256i const *)(src + i));
+    __m256i hi_nib = _mm256_and_si256(_mm256_srli_epi32(x, 4), m2f);
+    __m256i bad = _mm256_and_si256(
+      _mm256_shuffle_epi8(lut_lo, _mm256_and_si256(x, m2f)),
+      _mm256_shuffle_epi8(lut_hi, hi_nib));
+    if (!_mm256_testz_si256(bad, bad)) break;
+    x = _mm256_add_epi8(x, _mm256_shuffle_epi8(lut_roll,
+      _mm256_add_epi8(_mm256_cmpeq_epi8(x, m2f), hi_nib)));
+    x = _mm256_maddubs_epi16(x, _mm256_set1_epi32(0x01400140));
+    x = _mm256_madd_epi16(x, _mm256_set1_epi32(0x00011000));
+    x = _mm256_shuffle_epi8(x, shuf);
+    x = _mm256_permutevar8x32_epi32(
+      x, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+    _mm256_storeu_si256((__m256i *)out, x);
+    i += 32;
+    out += 24;
+  }
+#endif
+#if defined(OSO_SSSE3)
+  while (n - i >= 24) {
+    __m128i const lut_lo = _mm_setr_epi8(OSO_B64_DEC_LUT_LO);
+    __m128i const lut_hi = _mm_setr_epi8(OSO_B64_DEC_LUT_HI);
+    __m128i const lut_roll = _mm_setr_epi8(OSO_B64_DEC_LUT_ROLL);
+    __m128i const shuf = _mm_setr_epi8(OSO_B64_DEC_SHUF);
+    __m128i const m2f = _mm_set1_epi8(0x2F);
+    __m128i x = _mm_loadu_si128((__m128i const *)(src + i));
+    __m128i hi_nib = _mm_and_si128(_mm_srli_epi32(x, 4), m2f);
+    __m128i bad = _mm_and_si128(
+      _mm_shuffle_epi8(lut_lo, _mm_and_si128(x, m2f)),
+      _mm_shuffle_epi8(lut_hi, hi_nib));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(bad, _mm_setzero_si128())) != 0xFFFF)
+      break;
+    x = _mm_add_epi8(x, _mm_shuffle_epi8(lut_roll,
+      _mm_add_epi8(_mm_cmpeq_epi8(x, m2f), hi_nib)));
+    x = _mm_maddubs_epi16(x, _mm_set1_epi32(0x01400140));
+    x = _mm_madd_epi16(x, _mm_set1_epi32(0x00011000));
+    _mm_storeu_si128((__m128i *)out, _mm_shuffle_epi8(x, shuf));
+    i += 16;
+    out += 12;
+  }
+#endif
+  /* The scalar loop finishes the tail, and also takes over from the SIMD
+     loops when they see an invalid character, to find out where it is. */
+  for (; i < n; i += 4) {
+    int a = oso_impl_b64val(src[i]), b = -1, c = 0, d = 0;
+    if (n - i > 1) b = oso_impl_b64val(src[i + 1]);
+    if (n - i > 2) c = oso_impl_b64val(src[i + 2]);
+    if (n - i > 3) d = oso_impl_b64val(src[i + 3]);
+    if ((a | b | c | d) < 0) {
+      *start = '\0';
+      return 0;
+    }
+    *out++ = (char)(a << 2 | b >> 4);
+    if (out < end) *out++ = (char)((b << 4 | c >> 2) & 0xFF);
+    if (out < end) *out++ = (char)((c << 6 | d) & 0xFF);
+  }
+  oso_impl_catfinish(*p, out);
+  return 1;
+}
+
+int
+osocathex(oso **p, char const *cstr, size_t len) {
+  unsigned char const *src = (unsigned char const *)cstr;
+  size_t i = 0;
+  char *out = oso_impl_catreserve(p, len, 2);
+  if (!out) return 0;
+#if defined(OSO_AVX2)
+  for (; len - i >= 32; i += 32, out += 64) {
+    __m256i const lut = _mm256_setr_epi8('0', '1', '2', '3', '4', '5', '6',
+      '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f', '0', '1', '2', '3', '4',
+      '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    __m256i const nib = _mm256_set1_epi8(0x0F);
+    __m256i x = _mm256_permute4x64_epi64(
+      _mm256_loadu_si256((__m256i const *)(src + i)), 0xD8);
+    __m256i hi = _mm256_shuffle_epi8(
+      lut, _mm256_and_si256(_mm256_srli_epi16(x, 4), nib));
+    __m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(x, nib));
+    _mm256_storeu_si256((__m256i *)out, _mm256_unpacklo_epi8(hi, lo));
+    _mm256_storeu_si256((__m256i *)(out + 32), _mm256_unpackhi_epi8(hi, lo));
+  }
+#endif
+#if defined(OSO_SSSE3)
+  for (; len - i >= 16; i += 16, out += 32) {
+    __m128i const lut = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+      '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    __m128i const nib = _mm_set1_epi8(0x0F);
+    __m128i x = _mm_loadu_si128((__m128i const *)(src + i));
+    __m128i hi =
+      _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(x, 4), nib));
+    __m128i lo = _mm_shuffle_epi8(lut, _mm_and_si128(x, nib));
+    _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128((__m128i *)(out + 16), _mm_unpackhi_epi8(hi, lo));
+  }
+#endif
+  for (; i < len; i++, out += 2) {
+    out[0] = oso_impl_hexlower[src[i] >> 4];
+    out[1] = oso_impl_hexlower[src[i] & 0xF];
+  }
+  oso_impl_catfinish(*p, out);
+  return 1;
+}
+
+int
+osocathexdec(oso **p, char const *cstr, size_t len) {
+  unsigned char const *src = (unsigned char const *)cstr;
+  size_t i = 0;
+  char *out, *start;
+  if (len % 2) return 0;
+  start = out = oso_impl_catreserve(p, len / 2, 1);
+  if (!out) return 0;
+#if defined(OSO_SSSE3)
+  for (; len - i >= 32; i += 32, out += 16) {
+    __m128i v[2];
+    int k;
+    for (k = 0; k < 2; k++) {
+      __m128i x = _mm_loadu_si128((__m128i const *)(src + i + k * 16));
+      __m128i d = _mm_sub_epi8(x, _mm_set1_epi8('0'));
+      __m128i l = _mm_sub_epi8(
+        _mm_or_si128(x, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+      __m128i is_d = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+      __m128i is_l = _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8(5)), l);
+      if (_mm_movemask_epi8(_mm_or_si128(is_d, is_l)) != 0xFFFF) break;
+      v[k] = _mm_or_si128(_mm_and_si128(is_d, d),
+        _mm_and_si128(is_l, _mm_add_epi8(l, _mm_set1_epi8(10))));
+      v[k] = _mm_maddubs_epi16(v[k], _mm_set1_epi16(0x0110));
+    }
+    if (k < 2) break;
+    _mm_storeu_si128((__m128i *)out, _mm_packus_epi16(v[0], v[1]));
+  }
+#endif
+  for (; i < len; i += 2) {
+    int hi = oso_impl_hexval(src[i]), lo = oso_impl_hexval(src[i + 1]);
+    if (hi < 0 || lo < 0) {
+      *start = '\0';
+      return 0;
+    }
+    *out++ = (char)(hi << 4 | lo);
+  }
+  oso_impl_catfinish(*p, out);
+  return 1;
+}
+
+void
+osopartrange(size_t count, size_t parts, size_t part, size_t *out_begin,
+             size_t *out_end) {
+  size_t q, r;
+  if (part >= parts) {
+    /* Also covers `parts` being 0. */
+    *out_begin = *out_end = count;
+    return;
+  }
+  q = count / parts;
+  r = count % parts;
+  *out_begin = part * q + (part < r ? part : r);
+  *out_end = *out_begin + q + (part < r);
+}
+
+int
+osoconcatprep(oso **p, oso const *const *shards, size_t n, size_t *out_base) {
+  size_t total = 0, len, i;
+  for (i = 0; i < n; i++) {
+    size_t add = osolen(shards[i]);
+    if (total + add < total) return oso_impl_allocfail(p);
+    total += add;
+  }
+  if (!osomakeroomfor(p, total)) return 0;
+  len = OSO_HDR(*p)->len;
+  *out_base = len;
+  OSO_HDR(*p)->len = len + total;
+  OSO_DIRTY(OSO_HDR(*p));
+  ((char *)*p)[len + total] = '\0';
+  return 1;
+}
+
+void
+osoconcatpart(oso *s, size_t base, oso const *const *shards, size_t n,
+              size_t part, size_t parts) {
+  size_t begin, end, pos = 0, i;
+  if (part >= parts || base > osolen(s)) return;
+  osopartrange(osolen(s) - base, parts, part, &begin, &end);
+  for (i = 0; i < n && pos < end; i++) {
+    size_t len = osolen(shards[i]), lo, hi;
+    if (len && pos + len > begin) {
+      lo = begin > pos ? begin - pos : 0;
+      hi = end < pos + len ? end - pos : len;
+      oso_impl_copy((char *)s + base + pos + lo,
+                    (char const *)shards[i] + lo, hi - lo);
+    }
+    pos += len;
+  }
+}
+
+OSO_NOINLINE int
+osofill(oso **p, char c, size_t n) {
+  oso_header *hdr;
+  if (!osomakeroomfor(p, n)) return 0;
+  hdr = OSO_HDR(*p);
+  oso_impl_fill((char *)*p + hdr->len, c, n);
+  hdr->len += n;
+  OSO_DIRTY(hdr);
+  ((char *)*p)[hdr->len] = '\0';
+  return 1;
+}
+
+struct oso_concatjob {
+  oso *s;
+  size_t base, n;
+  oso const *const *shards;
+};
+
+static void
+oso_impl_concatpart(void *arg, size_t part, size_t parts) {
+  struct oso_concatjob const *job = (struct oso_concatjob const *)arg;
+  osoconcatpart(job->s, job->base, job->shards, job->n, part, parts);
+}
+
+int
+osoconcat(oso **p, oso const *const *shards, size_t n) {
+  struct oso_concatjob job;
+  if (!osoconcatprep(p, shards, n, &job.base)) return 0;
+  job.s = *p;
+  job.shards = shards;
+  job.n = n;
+  /* Split by bytes across the pool, so lots of small shards get copied in
+     parallel too, not just the big ones. */
+  if (OSO_POOL_PARTS > 1 && osolen(*p) - job.base >= OSO_PARALLEL_THRESHOLD)
+    oso_impl_parallel(oso_impl_concatpart, &job, OSO_POOL_PARTS);
+  else
+    osoconcatpart(*p, job.base, shards, n, 0, 1);
+  return 1;
+}
+
+/* SWAR check that all 8 bytes are '0' through '9'. Adding 6 pushes anything
+   above '9' into the next high nibble. */
+static int
+oso_impl_is8digits(oso_u64 v) {
+  oso_u64 const hi = OSO_U64(0xF0F0F0F0, 0xF0F0F0F0);
+  return ((v & hi) | (((v + OSO_U64(0x06060606, 0x06060606)) & hi) >> 4)) ==
+         OSO_U64(0x33333333, 0x33333333);
+}
+
+/* SWAR conversion of 8 digits (first digit in the low byte) to their value,
+   combining pairs, then quads, then both halves with multiplies. */
+static oso_u64
+oso_impl_parse8(oso_u64 v) {
+  oso_u64 const mask = OSO_U64(0x000000FF, 0x000000FF);
+  v -= OSO_U64(0x30303030, 0x30303030);
+  v = v * 10 + (v >> 8);
+  return ((v & mask) * OSO_U64(1000000, 100) +
+          ((v >> 16) & mask) * OSO_U64(10000, 1)) >> 32;
+}
+
+/* Accumulates the run of digits at the start of `s` into `*acc`. Returns how
+   many digits there were. Sets `*overflow` if the value didn't fit, but still
+   consumes all of the digits. */
+static size_t
+oso_impl_digits(unsigned char const *s, size_t len, oso_u64 *acc,
+                int *overflow) {
+  /* Largest value that can take 8 more digits without overflowing. */
+  oso_u64 const room8 = OSO_U64(0x2A, 0xF31DC461); /* 184467440737 */
+  oso_u64 const max = (oso_u64)-1;
+  oso_u64 v = *acc;
+  size_t i = 0;
+  while (len - i >= 8 && v < room8) {
+    oso_u64 w = oso_impl_load8(s + i);
+    if (!oso_impl_is8digits(w)) break;
+    v = v * 100000000 + oso_impl_parse8(w);
+    i += 8;
+  }
+  for (; i < len && s[i] >= '0' && s[i] <= '9'; i++) {
+    unsigned d = (unsigned)(s[i] - '0');
+    if (v > (max - d) / 10) {
+      *overflow = 1;
+      v = max;
+    } else {
+      v = v * 10 + d;
+    }
+  }
+  *acc = v;
+  return i;
+}
+
+int
+osotou64(char const *cstr, size_t len, oso_u64 *out, size_t *out_end) {
+  unsigned char const *s = (unsigned char const *)cstr;
+  size_t i = 0, n;
+  oso_u64 v = 0;
+  int overflow = 0;
+  if (len && s[0] == '+') i++;
+  n = oso_impl_digits(s + i, len - i, &v, &overflow);
+  *out = v;
+  if (!n) {
+    if (out_end) *out_end = 0;
+    return 0;
+  }
+  if (out_end) *out_end = i + n;
+  return !overflow;
+}
+
+int
+osotoi64(char const *cstr, size_t len, oso_i64 *out, size_t *out_end) {
+  unsigned char const *s = (unsigned char const *)cstr;
+  oso_u64 const limit = (oso_u64)1 << 63;
+  size_t i = 0, n;
+  oso_u64 v = 0;
+  int overflow = 0, neg = 0;
+  if (len && (s[0] == '+' || s[0] == '-')) neg = s[i++] == '-';
+  n = oso_impl_digits(s + i, len - i, &v, &overflow);
+  if (!n) {
+    *out = 0;
+    if (out_end) *out_end = 0;
+    return 0;
+  }
+  if (out_end) *out_end = i + n;
+  if (overflow || v > limit - !neg) {
+    overflow = 1;
+    v = limit - !neg;
+  }
+  *out = neg ? -(oso_i64)(v - 1) - 1 : (oso_i64)v;
+  return !overflow;
+}
+
+/* Exact powers of ten that a double can hold, for Clinger's fast path. */
+static double const oso_impl_pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6,
+  1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+  1e20, 1e21, 1e22};
+
+/* Significant digits kept for the slow path of `osotodouble()`. The exact
+   halfway point between two doubles never has more than 767, so any digits
+   after these only matter as "more than zero", and they become one sticky
+   digit. */
+#define OSO_DOUBLE_DIGITS 768
+
+/* The digits are gathered into a 64-bit mantissa (8 at a time with SWAR) and
+   a power of ten. If the mantissa and the power are both exact in a double,
+   one multiply or divide gives the correctly rounded result (Clinger's fast
+   path). That needs doubles to be evaluated at double precision, which
+   <float.h> says with FLT_EVAL_METHOD. Otherwise the first
+   `OSO_DOUBLE_DIGITS` significant digits, a sticky 1 if any nonzero digits
+   were cut off, and the corrected exponent are handed to strtod() as an
+   integer with an exponent, like "12345e-3", which has no decimal point for
+   the locale to get wrong. */
+int
+osotodouble(char const *cstr, size_t len, double *out, size_t *out_end) {
+  unsigned char const *s = (unsigned char const *)cstr;
+  oso_u64 const room8 = OSO_U64(0x2A, 0xF31DC461); /* 184467440737 */
+  oso_u64 const room1 = OSO_U64(0x19999999, 0x99999999);
+  size_t i = 0, int_start, int_end = 0, frac_start = 0, frac_end = 0;
+  oso_u64 mant = 0;
+  long exp10 = 0, e = 0;
+  int neg = 0, exact = 1, frac;
+  double d;
+  if (len && (s[0] == '+' || s[0] == '-')) neg = s[i++] == '-';
+  int_start = i;
+  for (frac = 0; frac < 2; frac++) {
+    if (frac) {
+      if (i == len || s[i] != '.') break;
+      frac_start = ++i;
+    }
+    while (len - i >= 8 && mant < room8) {
+      oso_u64 w = oso_impl_load8(s + i);
+      if (!oso_impl_is8digits(w)) break;
+      mant = mant * 100000000 + oso_impl_parse8(w);
+      if (frac) exp10 -= 8;
+      i += 8;
+    }
+    for (; i < len && s[i] >= '0' && s[i] <= '9'; i++) {
+      if (mant < room1) {
+        mant = mant * 10 + (oso_u64)(s[i] - '0');
+        if (frac) exp10--;
+      } else {
+        exact = 0;
+        if (!frac) exp10++;
+      }
+    }
+    if (frac) frac_end = i;
+    else int_end = i;
+  }
+  if (int_end == int_start && frac_end == frac_start) {
+    *out = 0;
+    if (out_end) *out_end = 0;
+    return 0;
+  }
+  if (i < len && (s[i] == 'e' || s[i] == 'E')) {
+    size_t j = i + 1;
+    int eneg = 0;
+    if (j < len && (s[j] == '+' || s[j] == '-')) eneg = s[j++] == '-';
+    if (j < len && s[j] >= '0' && s[j] <= '9') {
+      for (; j < len && s[j] >= '0' && s[j] <= '9'; j++)
+        if (e < 100000) e = e * 10 + (s[j] - '0');
+      if (eneg) e = -e;
+      exp10 += e;
+      i = j;
+    }
+  }
+  if (out_end) *out_end = i;
+  if (!mant) {
+    d = 0.0;
+  } else if (exact && mant <= (oso_u64)1 << 53 && exp10 >= -22 &&
+             exp10 <= 22
+#if !defined(FLT_EVAL_METHOD) || FLT_EVAL_METHOD != 0
+             && 0 /* extra precision would double-round */
+#endif
+  ) {
+    d = (double)mant;
+    d = exp10 < 0 ? d / oso_impl_pow10[-exp10] : d * oso_impl_pow10[exp10];
+  } else {
+    /* Room for the digits, the sticky digit and "e-" plus a long. */
+    char buf[OSO_DOUBLE_DIGITS + 32];
+    size_t kept = 0, cut = 0, k;
+    int sticky = 0;
+    for (frac = 0; frac < 2; frac++) {
+      size_t begin = frac ? frac_start : int_start;
+      size_t end = frac ? frac_end : int_end;
+      for (k = begin; k < end; k++) {
+        if (kept < OSO_DOUBLE_DIGITS) {
+          if (kept || s[k] != '0') buf[kept++] = (char)s[k];
+        } else {
+          sticky |= s[k] != '0';
+          cut++;
+        }
+      }
+      /* Every digit of the fraction, kept or not, scales the value down. */
+      if (frac) e -= (long)(frac_end - frac_start);
+    }
+    /* Digits cut from the end scale the kept ones up. Past this many, the
+       value is out of range whatever the exponent was. */
+    e += cut < 200000 ? (long)cut : 200000;
+    if (sticky) {
+      buf[kept++] = '1';
+      e--;
+    }
+    oso_implsp_sprintf(buf + kept, "e%ld", e);
+    d = strtod(buf, NULL);
+  }
+  *out = neg ? -d : d;
+  return d < HUGE_VAL;
+}
+
+#undef OSO_DOUBLE_DIGITS
+
+/* Double formatting uses Grisu2 from Florian Loitsch, "Printing
+   Floating-Point Numbers Quickly and Accurately with Integers". The value and
+   the edges of its rounding interval are scaled by a cached power of ten into
+   a range where the digits fall out of 64-bit integer math, and digits are
+   generated until the result is inside the interval. The output always reads
+   back as the same double, and is the shortest such output for nearly all
+   inputs. */
+struct oso_diyfp {
+  oso_u64 f;
+  int e;
+};
+
+struct oso_cachedpow {
+  oso_u64 f;
+  short e, k;
+};
+
+/* 10^k for k = -348, -340, ..., 340, as a normalized 64-bit significand and
+   binary exponent. */
+static struct oso_cachedpow const oso_impl_cachedpows[] = {
+  {OSO_U64(0xFA8FD5A0, 0x081C0288), -1220, -348},
+  {OSO_U64(0xBAAEE17F, 0xA23EBF76), -1193, -340},
+  {OSO_U64(0x8B16FB20, 0x3055AC76), -1166, -332},
+  {OSO_U64(0xCF42894A, 0x5DCE35EA), -1140, -324},
+  {OSO_U64(0x9A6BB0AA, 0x55653B2D), -1113, -316},
+  {OSO_U64(0xE61ACF03, 0x3D1A45DF), -1087, -308},
+  {OSO_U64(0xAB70FE17, 0xC79AC6CA), -1060, -300},
+  {OSO_U64(0xFF77B1FC, 0xBEBCDC4F), -1034, -292},
+  {OSO_U64(0xBE5691EF, 0x416BD60C), -1007, -284},
+  {OSO_U64(0x8DD01FAD, 0x907FFC3C), -980, -276},
+  {OSO_U64(0xD3515C28, 0x31559A83), -954, -268},
+  {OSO_U64(0x9D71AC8F, 0xADA6C9B5), -927, -260},
+  {OSO_U64(0xEA9C2277, 0x23EE8BCB), -901, -252},
+  {OSO_U64(0xAECC4991, 0x4078536D), -874, -244},
+  {OSO_U64(0x823C1279, 0x5DB6CE57), -847, -236},
+  {OSO_U64(0xC2109436, 0x4DFB5637), -821, -228},
+  {OSO_U64(0x9096EA6F, 0x3848984F), -794, -220},
+  {OSO_U64(0xD77485CB, 0x25823AC7), -768, -212},
+  {OSO_U64(0xA086CFCD, 0x97BF97F4), -741, -204},
+  {OSO_U64(0xEF340A98, 0x172AACE5), -715, -196},
+  {OSO_U64(0xB23867FB, 0x2A35B28E), -688, -188},
+  {OSO_U64(0x84C8D4DF, 0xD2C63F3B), -661, -180},
+  {OSO_U64(0xC5DD4427, 0x1AD3CDBA), -635, -172},
+  {OSO_U64(0x936B9FCE, 0xBB25C996), -608, -164},
+  {OSO_U64(0xDBAC6C24, 0x7D62A584), -582, -156},
+  {OSO_U64(0xA3AB6658, 0x0D5FDAF6), -555, -148},
+  {OSO_U64(0xF3E2F893, 0xDEC3F126), -529, -140},
+  {OSO_U64(0xB5B5ADA8, 0xAAFF80B8), -502, -132},
+  {OSO_U64(0x87625F05, 0x6C7C4A8B), -475, -124},
+  {OSO_U64(0xC9BCFF60, 0x34C13053), -449, -116},
+  {OSO_U64(0x964E858C, 0x91BA2655), -422, -108},
+  {OSO_U64(0xDFF97724, 0x70297EBD), -396, -100},
+  {OSO_U64(0xA6DFBD9F, 0xB8E5B88F), -369, -92},
+  {OSO_U64(0xF8A95FCF, 0x88747D94), -343, -84},
+  {OSO_U64(0xB9447093, 0x8FA89BCF), -316, -76},
+  {OSO_U64(0x8A08F0F8, 0xBF0F156B), -289, -68},
+  {OSO_U64(0xCDB02555, 0x653131B6), -263, -60},
+  {OSO_U64(0x993FE2C6, 0xD07B7FAC), -236, -52},
+  {OSO_U64(0xE45C10C4, 0x2A2B3B06), -210, -44},
+  {OSO_U64(0xAA242499, 0x697392D3), -183, -36},
+  {OSO_U64(0xFD87B5F2, 0x8300CA0E), -157, -28},
+  {OSO_U64(0xBCE50864, 0x92111AEB), -130, -20},
+  {OSO_U64(0x8CBCCC09, 0x6F5088CC), -103, -12},
+  {OSO_U64(0xD1B71758, 0xE219652C), -77, -4},
+  {OSO_U64(0x9C400000, 0x00000000), -50, 4},
+  {OSO_U64(0xE8D4A510, 0x00000000), -24, 12},
+  {OSO_U64(0xAD78EBC5, 0xAC620000), 3, 20},
+  {OSO_U64(0x813F3978, 0xF8940984), 30, 28},
+  {OSO_U64(0xC097CE7B, 0xC90715B3), 56, 36},
+  {OSO_U64(0x8F7E32CE, 0x7BEA5C70), 83, 44},
+  {OSO_U64(0xD5D238A4, 0xABE98068), 109, 52},
+  {OSO_U64(0x9F4F2726, 0x179A2245), 136, 60},
+  {OSO_U64(0xED63A231, 0xD4C4FB27), 162, 68},
+  {OSO_U64(0xB0DE6538, 0x8CC8ADA8), 189, 76},
+  {OSO_U64(0x83C7088E, 0x1AAB65DB), 216, 84},
+  {OSO_U64(0xC45D1DF9, 0x42711D9A), 242, 92},
+  {OSO_U64(0x924D692C, 0xA61BE758), 269, 100},
+  {OSO_U64(0xDA01EE64, 0x1A708DEA), 295, 108},
+  {OSO_U64(0xA26DA399, 0x9AEF774A), 322, 116},
+  {OSO_U64(0xF209787B, 0xB47D6B85), 348, 124},
+  {OSO_U64(0xB454E4A1, 0x79DD1877), 375, 132},
+  {OSO_U64(0x865B8692, 0x5B9BC5C2), 402, 140},
+  {OSO_U64(0xC83553C5, 0xC8965D3D), 428, 148},
+  {OSO_U64(0x952AB45C, 0xFA97A0B3), 455, 156},
+  {OSO_U64(0xDE469FBD, 0x99A05FE3), 481, 164},
+  {OSO_U64(0xA59BC234, 0xDB398C25), 508, 172},
+  {OSO_U64(0xF6C69A72, 0xA3989F5C), 534, 180},
+  {OSO_U64(0xB7DCBF53, 0x54E9BECE), 561, 188},
+  {OSO_U64(0x88FCF317, 0xF22241E2), 588, 196},
+  {OSO_U64(0xCC20CE9B, 0xD35C78A5), 614, 204},
+  {OSO_U64(0x98165AF3, 0x7B2153DF), 641, 212},
+  {OSO_U64(0xE2A0B5DC, 0x971F303A), 667, 220},
+  {OSO_U64(0xA8D9D153, 0x5CE3B396), 694, 228},
+  {OSO_U64(0xFB9B7CD9, 0xA4A7443C), 720, 236},
+  {OSO_U64(0xBB764C4C, 0xA7A44410), 747, 244},
+  {OSO_U64(0x8BAB8EEF, 0xB6409C1A), 774, 252},
+  {OSO_U64(0xD01FEF10, 0xA657842C), 800, 260},
+  {OSO_U64(0x9B10A4E5, 0xE9913129), 827, 268},
+  {OSO_U64(0xE7109BFB, 0xA19C0C9D), 853, 276},
+  {OSO_U64(0xAC2820D9, 0x623BF429), 880, 284},
+  {OSO_U64(0x80444B5E, 0x7AA7CF85), 907, 292},
+  {OSO_U64(0xBF21E440, 0x03ACDD2D), 933, 300},
+  {OSO_U64(0x8E679C2F, 0x5E44FF8F), 960, 308},
+  {OSO_U64(0xD433179D, 0x9C8CB841), 986, 316},
+  {OSO_U64(0x9E19DB92, 0xB4E31BA9), 1013, 324},
+  {OSO_U64(0xEB96BF6E, 0xBADF77D9), 1039, 332},
+  {OSO_U64(0xAF87023B, 0x9BF0EE6B), 1066, 340},
+};
+
+static struct oso_diyfp
+oso_impl_diyfp(oso_u64 f, int e) {
+  struct oso_diyfp x;
+  x.f = f;
+  x.e = e;
+  return x;
+}
+
+/* The upper 64 bits of the 128-bit product, rounded. */
+static struct oso_diyfp
+oso_impl_diyfpmul(struct oso_diyfp x, struct oso_diyfp y) {
+  oso_u64 const m32 = 0xFFFFFFFFu;
+  oso_u64 a = x.f >> 32, b = x.f & m32, c = y.f >> 32, d = y.f & m32;
+  oso_u64 ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  oso_u64 mid = (bd >> 32) + (ad & m32) + (bc & m32) + ((oso_u64)1 << 31);
+  return oso_impl_diyfp(ac + (ad >> 32) + (bc >> 32) + (mid >> 32),
+                        x.e + y.e + 64);
+}
+
+static struct oso_diyfp
+oso_impl_diyfpnorm(struct oso_diyfp x) {
+  while (!(x.f >> 63)) {
+    x.f <<= 1;
+    x.e--;
+  }
+  return x;
+}
+
+/* Nudges the last digit down while that moves the result closer to the exact
+   value and keeps it inside the rounding interval. */
+static void
+oso_impl_grisuround(char *buf, size_t len, oso_u64 dist, oso_u64 delta,
+                    oso_u64 rest, oso_u64 ten_k) {
+  while (rest < dist && delta - rest >= ten_k &&
+         (rest + ten_k < dist || dist - rest > rest + ten_k - dist)) {
+    buf[len - 1]--;
+    rest += ten_k;
+  }
+}
+
+/* Writes the digits of finite, positive `v` to `buf` (at most 17) and returns
+   how many. The value is the digits times 10^`*out_exp10`. */
+static size_t
+oso_impl_grisu2(char *buf, double v, int *out_exp10) {
+  oso_u64 bits, frac, one_f, p2, delta, dist, pow10;
+  unsigned long p1;
+  struct oso_diyfp w, w_plus, w_minus, c;
+  struct oso_cachedpow const *cp;
+  int biased, e, k, one_e, n;
+  size_t len = 0;
+  memcpy(&bits, &v, sizeof bits);
+  frac = bits & (((oso_u64)1 << 52) - 1);
+  biased = (int)(bits >> 52);
+  w = biased ? oso_impl_diyfp(frac | (oso_u64)1 << 52, biased - 1075)
+             : oso_impl_diyfp(frac, -1074);
+  w_plus = oso_impl_diyfpnorm(oso_impl_diyfp(w.f * 2 + 1, w.e - 1));
+  /* The gap below is half as big when v is a power of two. */
+  w_minus = !frac && biased > 1 ? oso_impl_diyfp(w.f * 4 - 1, w.e - 2)
+                                : oso_impl_diyfp(w.f * 2 - 1, w.e - 1);
+  w_minus.f <<= w_minus.e - w_plus.e;
+  w_minus.e = w_plus.e;
+  w = oso_impl_diyfpnorm(w);
+  /* Pick the power that puts the product's exponent in [-60, -32]. */
+  e = -61 - w_plus.e;
+  k = e * 78913 / (1 << 18) + (e > 0);
+  cp = &oso_impl_cachedpows[(348 + k + 7) / 8];
+  c = oso_impl_diyfp(cp->f, cp->e);
+  w = oso_impl_diyfpmul(w, c);
+  w_plus = oso_impl_diyfpmul(w_plus, c);
+  w_minus = oso_impl_diyfpmul(w_minus, c);
+  w_plus.f--;
+  w_minus.f++;
+  *out_exp10 = -cp->k;
+  delta = w_plus.f - w_minus.f;
+  dist = w_plus.f - w.f;
+  one_e = -w_plus.e;
+  one_f = (oso_u64)1 << one_e;
+  p1 = (unsigned long)(w_plus.f >> one_e);
+  p2 = w_plus.f & (one_f - 1);
+  for (n = 1, pow10 = 1; n < 10 && p1 >= pow10 * 10; n++) pow10 *= 10;
+  while (n > 0) {
+    oso_u64 rest;
+    buf[len++] = (char)('0' + p1 / pow10);
+    p1 %= (unsigned long)pow10;
+    n--;
+    rest = ((oso_u64)p1 << one_e) + p2;
+    if (rest <= delta) {
+      *out_exp10 += n;
+      oso_impl_grisuround(buf, len, dist, delta, rest, pow10 << one_e);
+      return len;
+    }
+    pow10 /= 10;
+  }
+  for (;;) {
+    p2 *= 10;
+    buf[len++] = (char)('0' + (p2 >> one_e));
+    p2 &= one_f - 1;
+    n++;
+    delta *= 10;
+    dist *= 10;
+    if (p2 <= delta) break;
+  }
+  *out_exp10 -= n;
+  oso_impl_grisuround(buf, len, dist, delta, p2, one_f);
+  return len;
+}
+
+int
+osocatdouble(oso **p, double d) {
+  char digits[17], *out;
+  int exp10, n, i;
+  size_t len;
+  oso_u64 bits;
+  if (d != d) return osocatlen(p, "nan", 3);
+  out = oso_impl_catreserve(p, 32, 1);
+  if (!out) return 0;
+  memcpy(&bits, &d, sizeof bits);
+  if (bits >> 63) {
+    *out++ = '-';
+    d = -d;
+  }
+  if (d == 0) {
+    *out++ = '0';
+  } else if (d > DBL_MAX) {
+    memcpy(out, "inf", 3);
+    out += 3;
+  } else {
+    len = oso_impl_grisu2(digits, d, &exp10);
+    n = (int)len + exp10; /* position of the decimal point */
+    if ((int)len <= n && n <= 21) {
+      memcpy(out, digits, len);
+      memset(out + len, '0', (size_t)n - len);
+      out += n;
+    } else if (0 < n && n <= 21) {
+      memcpy(out, digits, (size_t)n);
+      out[n] = '.';
+      memcpy(out + n + 1, digits + n, len - (size_t)n);
+      out += len + 1;
+    } else if (-6 < n && n <= 0) {
+      *out++ = '0';
+      *out++ = '.';
+      for (i = n; i < 0; i++) *out++ = '0';
+      memcpy(out, digits, len);
+      out += len;
+    } else {
+      *out++ = digits[0];
+      if (len > 1) {
+        *out++ = '.';
+        memcpy(out, digits + 1, len - 1);
+        out += len - 1;
+      }
+      out += oso_implsp_sprintf(out, "e%+d", n - 1);
+    }
+  }
+  oso_impl_catfinish(*p, out);
+  return 1;
+}
+
+#if defined(OSO_SSSE3)
+#undef OSO_B64_ENC_SHUF
+#undef OSO_B64_ENC_LUT
+#undef OSO_B64_DEC_LUT_LO
+#undef OSO_B64_DEC_LUT_HI
+#undef OSO_B64_DEC_LUT_ROLL
+#undef OSO_B64_DEC_SHUF
+#endif
+
+#if defined(OSO_POSIX)
+#if defined(IOV_MAX) && IOV_MAX < 64
+#define OSO_IOV_BATCH IOV_MAX
+#else
+#define OSO_IOV_BATCH 64
+#endif
+
+/* Writes every iovec in full, retrying on partial writes and EINTR. The
+   iovecs are modified. Returns 0, or an errno value. */
+OSO_INTERNAL int
+oso_impl_writeiov(int fd, struct iovec *iov, int count) {
+  while (count > 0) {
+    ssize_t res = writev(fd, iov, count);
+    size_t n;
+    if (res < 0) {
+      if (errno == EINTR) continue;
+      return errno;
+    }
+    n = (size_t)res;
+    while (count > 0 && n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0) {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  return 0;
+}
+
+int
+osowritefd(int fd, oso const *const *strs, size_t n) {
+  struct iovec iov[OSO_IOV_BATCH];
+  size_t i = 0;
+  while (i < n) {
+    int count = 0, err;
+    for (; i < n && count < OSO_IOV_BATCH; i++) {
+      size_t len = osolen(strs[i]);
+      if (!len) continue;
+      iov[count].iov_base = (void *)strs[i];
+      iov[count].iov_len = len;
+      count++;
+    }
+    err = oso_impl_writeiov(fd, iov, count);
+    if (err) return err;
+  }
+  return 0;
+}
+
+void
+osowriterinit(oso_writer *w, int fd, size_t high_water) {
+  w->buf = NULL;
+  w->high_water = high_water;
+  w->fd = fd;
+  w->err = 0;
+}
+
+int
+osowriterflush(oso_writer *w) {
+  if (w->err) return w->err;
+  if (!osolen(w->buf)) return 0;
+  w->err = osowritefd(w->fd, (oso const *const *)&w->buf, 1);
+  osoclear(&w->buf);
+  return w->err;
+}
+
+int
+osowritelen(oso_writer *w, char const *cstr, size_t len) {
+  size_t buf_len;
+  if (w->err) return w->err;
+  buf_len = osolen(w->buf);
+  if (buf_len + len <= w->high_water || len > OSO_CAP_MAX - buf_len) {
+    if (!osocatlen(&w->buf, cstr, len)) {
+#if defined(OSO_KEEP_ON_ALLOC_FAILURE)
+      /* The buffer is intact, so only this write is lost. */
+      return ENOMEM;
+#else
+      w->err = ENOMEM;
+#endif
+    } else if (buf_len + len == w->high_water) {
+      osowriterflush(w);
+    }
+    return w->err;
+  }
+  if (len < w->high_water) {
+    if (osowriterflush(w)) return w->err;
+    return osowritelen(w, cstr, len);
+  }
+  /* Too big to be worth buffering. Send it along with whatever's already
+     buffered, in one system call. */
+  {
+    struct iovec iov[2];
+    int count = 0;
+    if (buf_len) {
+      iov[count].iov_base = (void *)w->buf;
+      iov[count].iov_len = buf_len;
+      count++;
+    }
+    iov[count].iov_base = (void *)cstr;
+    iov[count].iov_len = len;
+    count++;
+    w->err = oso_impl_writeiov(w->fd, iov, count);
+    osoclear(&w->buf);
+  }
+  return w->err;
+}
+
+int
+osowrite(oso_writer *w, char const *cstr) {
+  return osowritelen(w, cstr, strlen(cstr));
+}
+
+int
+osowriteoso(oso_writer *w, oso const *s) {
+  if (!s) return w->err;
+  return osowritelen(w, (char const *)s, OSO_HDR(s)->len);
+}
+
+struct oso_writercbcontext {
+  oso_writer *w;
+  int err;
+  char tmp[STB_SPRINTF_MIN];
+};
+
+OSO_INTERNAL char *
+oso_impl_writercb(const char *buf, void *user, int len) {
+  struct oso_writercbcontext *c = (struct oso_writercbcontext *)user;
+  c->err = osowritelen(c->w, buf, (size_t)len);
+  if (c->err) return NULL;
+  return c->tmp;
+}
+
+int
+osowritevprintf(oso_writer *w, char const *fmt, va_list ap) {
+  struct oso_writercbcontext c;
+  if (w->err) return w->err;
+  c.w = w;
+  c.err = 0;
+  oso_implsp_vsprintfcb(oso_impl_writercb, &c, c.tmp, fmt, ap);
+  return c.err;
+}
+
+int
+osowriteprintf(oso_writer *w, char const *fmt, ...) {
+  int err;
+  va_list ap;
+  va_start(ap, fmt);
+  err = osowritevprintf(w, fmt, ap);
+  va_end(ap);
+  return err;
+}
+
+void
+osowriterfree(oso_writer *w) {
+  osowipe(&w->buf);
+}
+
+#undef OSO_IOV_BATCH
+#endif
+
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && \
+  !defined(__STDC_NO_THREADS__)
+#define OSO_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__) || defined(__clang__)
+#define OSO_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#define OSO_THREAD_LOCAL __declspec(thread)
+#endif
+
+#if defined(OSO_POSIX) && (defined(__GNUC__) || defined(__clang__))
+/* The log queue is a lock-free stack. Producers push with a compare and swap
+   loop, and the consumer takes the whole stack at once with an exchange and
+   then reverses it. Nothing is ever popped individually, so there's no ABA
+   problem. */
+struct oso_lognode {
+  struct oso_lognode *next;
+  oso *buf;
+};
+
+#if defined(OSO_THREADS)
+/* The background writer sleeps on `wake` while the queue is empty. The queue
+   itself stays lock-free. The lock is only taken to wake the writer after a
+   push, which happens once per full buffer, not once per line. Taking it there
+   means a push can't slip in between the writer seeing an empty queue and
+   going to sleep. */
+struct oso_logwriter {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  int fd, stop, err;
+};
+
+static void
+oso_impl_logwake(oso_logq *q) {
+  struct oso_logwriter *w =
+    (struct oso_logwriter *)__atomic_load_n(&q->writer, __ATOMIC_ACQUIRE);
+  if (!w) return;
+  pthread_mutex_lock(&w->lock);
+  pthread_cond_signal(&w->wake);
+  pthread_mutex_unlock(&w->lock);
+}
+
+static void *
+oso_impl_logwritermain(void *arg) {
+  oso_logq *q = (oso_logq *)arg;
+  struct oso_logwriter *w = (struct oso_logwriter *)q->writer;
+  pthread_mutex_lock(&w->lock);
+  for (;;) {
+    int err;
+    while (!w->stop && !__atomic_load_n(&q->head, __ATOMIC_ACQUIRE))
+      pthread_cond_wait(&w->wake, &w->lock);
+    if (w->stop) break;
+    pthread_mutex_unlock(&w->lock);
+    /* Whatever gets pushed while this is writing is picked up in one go the
+       next time around, so writes get bigger as the load goes up. */
+    err = osologqdrain(q, w->fd);
+    pthread_mutex_lock(&w->lock);
+    if (err && !w->err) w->err = err;
+  }
+  pthread_mutex_unlock(&w->lock);
+  return NULL;
+}
+
+int
+osologqstart(oso_logq *q, int fd) {
+  struct oso_logwriter *w;
+  int err;
+  if (q->writer) return EBUSY;
+  w = malloc(sizeof(struct oso_logwriter));
+  if (!w) return ENOMEM;
+  w->fd = fd;
+  w->stop = w->err = 0;
+  if ((err = pthread_mutex_init(&w->lock, NULL))) {
+    free(w);
+    return err;
+  }
+  if ((err = pthread_cond_init(&w->wake, NULL))) {
+    pthread_mutex_destroy(&w->lock);
+    free(w);
+    return err;
+  }
+  q->writer = w;
+  if ((err = pthread_create(&w->thread, NULL, oso_impl_logwritermain, q))) {
+    q->writer = NULL;
+    pthread_cond_destroy(&w->wake);
+    pthread_mutex_destroy(&w->lock);
+    free(w);
+  }
+  return err;
+}
+
+int
+osologqstop(oso_logq *q) {
+  struct oso_logwriter *w = (struct oso_logwriter *)q->writer;
+  int err;
+  if (!w) return 0;
+  pthread_mutex_lock(&w->lock);
+  w->stop = 1;
+  pthread_cond_signal(&w->wake);
+  pthread_mutex_unlock(&w->lock);
+  pthread_join(w->thread, NULL);
+  q->writer = NULL;
+  err = osologqdrain(q, w->fd);
+  if (w->err) err = w->err;
+  pthread_cond_destroy(&w->wake);
+  pthread_mutex_destroy(&w->lock);
+  free(w);
+  return err;
+}
+#endif
+
+void
+osologqinit(oso_logq *q) {
+  q->head = NULL;
+  q->writer = NULL;
+}
+
+int
+osologqpush(oso_logq *q, oso **p) {
+  struct oso_lognode *n;
+  void *head;
+  if (!osolen(*p)) return 1;
+  n = malloc(sizeof(struct oso_lognode));
+  if (!n) return 0;
+  n->buf = *p;
+  *p = NULL;
+  head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+  do {
+    n->next = (struct oso_lognode *)head;
+  } while (!__atomic_compare_exchange_n(
+    &q->head, &head, (void *)n, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+#if defined(OSO_THREADS)
+  oso_impl_logwake(q);
+#endif
+  return 1;
+}
+
+int
+osologprintf(oso_logq *q, oso **p, size_t high_water, char const *fmt, ...) {
+  int ok;
+  va_list ap;
+  va_start(ap, fmt);
+  ok = oso_impl_catvprintf(p, fmt, ap);
+  va_end(ap);
+  /* If the push fails, the buffer stays with the caller and gets pushed
+     next time. */
+  if (ok && osolen(*p) >= high_water) osologqpush(q, p);
+  return ok;
+}
+
+/* Each thread's `osolog()` buffer, and the queue it's for. */
+#ifndef OSO_LOG_HIGH_WATER
+#define OSO_LOG_HIGH_WATER ((size_t)1 << 16)
+#endif
+static OSO_THREAD_LOCAL oso *oso_impl_logbuf;
+static OSO_THREAD_LOCAL oso_logq *oso_impl_logbufq;
+
+int
+osolog(oso_logq *q, char const *fmt, ...) {
+  int ok;
+  va_list ap;
+  if (oso_impl_logbufq != q) {
+    /* Lines for a different queue can't share the buffer. */
+    if (oso_impl_logbufq && !osologflush()) return 0;
+    oso_impl_logbufq = q;
+  }
+  va_start(ap, fmt);
+  ok = oso_impl_catvprintf(&oso_impl_logbuf, fmt, ap);
+  va_end(ap);
+  if (ok && osolen(oso_impl_logbuf) >= OSO_LOG_HIGH_WATER)
+    osologqpush(q, &oso_impl_logbuf);
+  return ok;
+}
+
+int
+osologflush(void) {
+  if (!oso_impl_logbufq) return 1;
+  if (!osologqpush(oso_impl_logbufq, &oso_impl_logbuf)) return 0;
+  osofree(oso_impl_logbuf);
+  oso_impl_logbuf = NULL;
+  oso_impl_logbufq = NULL;
+  return 1;
+}
+
+int
+osologqdrain(oso_logq *q, int fd) {
+  struct oso_lognode *n, *prev = NULL, *next;
+  oso const *batch[64];
+  struct oso_lognode *nodes[64];
+  size_t count = 0, i;
+  int err = 0;
+  n = (struct oso_lognode *)__atomic_exchange_n(
+    &q->head, NULL, __ATOMIC_ACQUIRE);
+  while (n) {
+    next = n->next;
+    n->next = prev;
+    prev = n;
+    n = next;
+  }
+  for (n = prev; n; n = next) {
+    next = n->next;
+    batch[count] = n->buf;
+    nodes[count++] = n;
+    if (count < 64 && next) continue;
+    /* After an error, keep going so that the buffers are freed. */
+    if (!err) err = osowritefd(fd, batch, count);
+    for (i = 0; i < count; i++) {
+      osofree(nodes[i]->buf);
+      free(nodes[i]);
+    }
+    count = 0;
+  }
+  return err;
+}
+
+void
+osologqfree(oso_logq *q) {
+  struct oso_lognode *n = (struct oso_lognode *)__atomic_exchange_n(
+    &q->head, NULL, __ATOMIC_ACQUIRE);
+  while (n) {
+    struct oso_lognode *next = n->next;
+    osofree(n->buf);
+    free(n);
+    n = next;
+  }
+}
+#endif
+
+/* Each thread keeps a small stack of cleared strings. Without thread-local
+   storage there's no pool, and scratch strings are plain allocations. */
+#define OSO_SCRATCH_COUNT 8
+#ifndef OSO_SCRATCH_MAX_CAP
+#define OSO_SCRATCH_MAX_CAP ((size_t)1 << 16)
+#endif
+#ifndef OSO_SCRATCH_MIN_CAP
+#define OSO_SCRATCH_MIN_CAP ((size_t)256)
+#endif
+
+#if defined(OSO_THREAD_LOCAL)
+static OSO_THREAD_LOCAL oso *oso_impl_scratch[OSO_SCRATCH_COUNT];
+static OSO_THREAD_LOCAL size_t oso_impl_scratchcount;
+#endif
+
+oso *
+ososcratchget(void) {
+  oso *s = NULL;
+#if defined(OSO_THREAD_LOCAL)
+  if (oso_impl_scratchcount)
+    return oso_impl_scratch[--oso_impl_scratchcount];
+#endif
+  /* If this fails, the null is still an empty oso. */
+  osoensurecap(&s, OSO_SCRATCH_MIN_CAP);
+  return s;
+}
+
+void
+ososcratchput(oso *s) {
+#if defined(OSO_THREAD_LOCAL)
+  oso_header *hdr;
+  if (!s) return;
+  hdr = OSO_HDR(s);
+  if (oso_impl_scratchcount < OSO_SCRATCH_COUNT &&
+      !(hdr->cap & (OSO_FLAG_INLINE | OSO_FLAG_MAPPED)) &&
+      OSO_CAPOF(hdr) <= OSO_SCRATCH_MAX_CAP) {
+    hdr->len = 0;
+    OSO_DIRTY(hdr);
+    ((char *)s)[0] = '\0';
+    oso_impl_scratch[oso_impl_scratchcount++] = s;
+    return;
+  }
+#endif
+  osofree(s);
+}
+
+void
+ososcratchfree(void) {
+#if defined(OSO_THREAD_LOCAL)
+  while (oso_impl_scratchcount)
+    osofree(oso_impl_scratch[--oso_impl_scratchcount]);
+#endif
+}
+
 #undef OSO_NOINLINE
 #undef OSO_HDR
 #undef OSO_CAP_MAX
+#undef OSO_STREAM_THRESHOLD
+#undef OSO_PARALLEL_THRESHOLD
+#undef OSO_PARALLEL_SORT_MIN
+#undef OSO_POOL_PARTS
+#undef OSO_POOL
+#undef OSO_THREAD_LOCAL
+#undef OSO_LOG_HIGH_WATER
+#undef OSO_SCRATCH_COUNT
+#undef OSO_SCRATCH_MAX_CAP
+#undef OSO_SCRATCH_MIN_CAP
+#undef OSO_CAPOF
+#undef OSO_VA_COPY
+#undef OSO_FLAG_INLINE
+#undef OSO_FLAG_MAPPED
+#undef OSO_FLAG_HASHED
+#undef OSO_DIRTY
+#undef OSO_HASH_S0
+#undef OSO_HASH_S1
+#undef OSO_HASH_S2
+#undef OSO_HASH_S3
 #undef OSO_INTERNAL
+#undef OSO_FORMAT_MAX
+#undef OSO_FORMAT_NAME_MAX
+#undef OSO_INTMAX
+#undef OSO_UINTMAX
+#undef OSO_ROPE_LEAF_MAX
+#undef OSO_MAP_GROUP
+#undef OSO_MAP_EMPTY
+#undef OSO_MAP_DELETED
+#undef OSO_SSE2
+#undef OSO_SSSE3
+#undef OSO_AVX2
+#undef OSO_U64
+#undef OSO_POSIX
+#undef OSO_MMAP
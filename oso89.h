@@ -49,6 +49,7 @@ osocatoso(&mystring, *mystring); // Bad, no idea what happens
     ______len    -> Do it with an explicit length argument, so the
                     C-string doesn't have to be null-terminated.
     ______oso    -> Do it with a second oso string.
+    ______rope   -> Do it with an oso_rope.
     ______printf -> Do it by using printf.
 
 
@@ -64,6 +65,64 @@ lose your string. But the upside is that you can more easily check for and
 handle out-of-memory situations if they do happen. Because of how tedious it
 traditionally is, lots of libc/UNIX C software doessn't bother trying to handle
 out-of-memory situations at all.
+
+The functions that can grow a string also return 1 on success and 0 on
+failure, so you can check that instead of checking for null.
+
+If you'd rather keep your string, define OSO_KEEP_ON_ALLOC_FAILURE when
+compiling oso89.c. Then a failed allocation leaves the `oso *` exactly as it
+was before the call, and the 0 return is the only sign that anything went
+wrong. This lets you retry later or shed load without having to rebuild the
+string.
+
+The containers below (rope, vec, map, writer and log queue) follow the same
+rule.
+
+if (!osocatprintf(&mystring, "%d waffles", count)) {
+  // Out of memory. With OSO_KEEP_ON_ALLOC_FAILURE, mystring is unchanged.
+  // Without it, mystring is now null.
+}
+
+
+                            HUGE STRINGS
+                           --------------
+
+On Linux, you can define OSO_MMAP_THRESHOLD to a number of bytes when
+compiling oso89.c. Any string whose allocation reaches that size gets its own
+page-aligned anonymous mapping, with a transparent hugepage hint, and grows
+with mremap(). The kernel moves the pages around instead of copying them, so
+growing a string of several gigabytes doesn't memcpy it each time.
+
+A few megabytes is a sensible threshold, like -DOSO_MMAP_THRESHOLD=4194304.
+Nothing else about using oso changes.
+
+Fills of 4 MB or more (see `osofill()`) use non-temporal stores when SSE2
+is available, so a single huge fill doesn't push everything else out of the
+CPU cache. Define OSO_STREAM_THRESHOLD to a number of bytes to change the
+cutoff. Huge copies are left to memcpy(), which does the same thing in
+glibc.
+
+
+                                SIMD
+                               ------
+
+Some functions use SSE2, SSSE3 or AVX2 when the compiler is targeting a CPU
+that has them, like with -march=haswell. Define OSO_NO_SIMD when compiling
+oso89.c to use only the portable code. The results are the same either way.
+
+
+                               THREADS
+                              ---------
+
+On POSIX systems, you can define OSO_THREADS to a number of threads when
+compiling oso89.c, like -DOSO_THREADS=8, and link with -pthread. Then some
+big jobs are split across that many threads: sorting a long array with
+`ososort()`, and copies, fills and concatenations of 16 MB or more
+(OSO_PARALLEL_THRESHOLD). That helps on machines where one core can't use all
+of the memory bandwidth. The library starts the extra threads the first time
+it needs them, and they stay around, waiting, until the program exits. Only
+one job uses them at a time; others that happen meanwhile run on their own
+thread as usual.
 */
 
 #include <stdarg.h>
@@ -83,12 +142,43 @@ out-of-memory situations at all.
 #ifndef OSO_NONNULL
 #define OSO_NONNULL(args)
 #endif
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L
+#define OSO_INLINE static inline
+#elif defined(__GNUC__) || defined(__clang__)
+#define OSO_INLINE static __inline__
+#elif defined(_MSC_VER)
+#define OSO_INLINE static __inline
+#else
+#define OSO_INLINE static
+#endif
+
+/* For the inline functions only. In every build, the string's length and
+   capacity are the two words right before its data, and the top three bits
+   of the capacity are flags. The third one means a cached hash is valid. */
+#define OSO_IMPL_LEN(s) (((size_t *)(s))[-2])
+#define OSO_IMPL_CAP(s) \
+  (((size_t *)(s))[-1] & ~((size_t)7 << (sizeof(size_t) * 8 - 3)))
+#define OSO_IMPL_DIRTY(s) \
+  (((size_t *)(s))[-1] &= ~((size_t)1 << (sizeof(size_t) * 8 - 3)))
+
+/* 64-bit integers, for the number parsing functions. C89 doesn't have them,
+   but every compiler we care about does. */
+#if defined(_MSC_VER)
+typedef __int64 oso_i64;
+typedef unsigned __int64 oso_u64;
+#elif defined(__GNUC__) || defined(__clang__)
+__extension__ typedef long long oso_i64;
+__extension__ typedef unsigned long long oso_u64;
+#else
+typedef long long oso_i64;
+typedef unsigned long long oso_u64;
+#endif
 
 /* clang-format off */
 
 typedef struct oso oso;
 
-void
+int
 osoput(oso **p, char const *cstr)
 /* Copies the null-terminated string on the right side into the left, replacing
    its contents.
@@ -102,29 +192,29 @@ osoput(oso **p, char const *cstr)
    puts((char *)color); "red" */
    OSO_NONNULL((1, 2));
 
-void
+int
 osoputlen(oso **p, char const *cstr, size_t len)
 /* Like `osoput()`, but you specify the length (number of non-null chars) for
    the right side instead of it scanning for a null terminator.
    having a null terminator. */
    OSO_NONNULL((1, 2));
 
-void
+int
 osoputoso(oso **p, oso const *other)
 /* Like `osoput()`, but the right side is an oso. */
    OSO_NONNULL((1));
 
-void
+int
 osoputprintf(oso **p, char const *fmt, ...)
 /* Like `osoput()`, but do it with a printf. */
    OSO_NONNULL((1, 2)) OSO_PRINTF(2, 3);
 
-void
+int
 osoputvprintf(oso **p, char const *fmt, va_list ap)
 /* Like `osoput()`, but do it with a vprintf. */
    OSO_NONNULL((1, 2)) OSO_PRINTF(2, 0);
 
-void
+int
 osocat(oso **p, char const *cstr)
 /* Appends the contents of the right side onto the left. The pointed-to pointer
    will be reallocated if necessary.
@@ -135,28 +225,104 @@ osocat(oso **p, char const *cstr)
    puts((char *)fungus); "mushroom" */
    OSO_NONNULL((1, 2));
 
-void
+int
 osocatlen(oso **p, char const *cstr, size_t len)
 /* Like `osocat()`, but you specify the length (number of non-null chars) for
    the right side instead of it scanning for a null terminator. */
    OSO_NONNULL((1, 2));
 
-void
+int
 osocatoso(oso **p, oso const *other)
 /* Like `osocat()`, but the right side side is an oso. */
    OSO_NONNULL((1));
 
-void
+int
 osocatprintf(oso **p, char const *fmt, ...)
-/* Like `osocat()`, but do it with a pritnf. */
+/* Like `osocat()`, but do it with a pritnf.
+
+   All of the printf functions here, including the bounded ones and the ones
+   for `oso_writer`, also take `%S`, whose argument is an `oso const *`. Its
+   length is read from the oso instead of scanning for a null terminator, so
+   it's cheaper than `%s` for big strings, and embedded null characters are
+   copied too. Flags, width and precision work exactly like they do for `%s`.
+   A null oso prints as an empty string. Only the first 2 GB - 1 of an oso are
+   printed, since stb_sprintf counts in `int`. Compilers that check printf
+   formats think `%S` means a wide string, so you may need to quiet -Wformat
+   where you use it.
+
+   osocatprintf(&line, "%s=%S", key, value); */
    OSO_NONNULL((1, 2)) OSO_PRINTF(2, 3);
 
-void
+int
 osocatvprintf(oso **p, char const *fmt, va_list ap)
 /* Like `osocat()`, but do it with a vprintf. */
    OSO_NONNULL((1, 2)) OSO_PRINTF(2, 0);
 
-void
+size_t
+osocatbounded(oso *s, char const *cstr)
+/* Like `osocat()`, but never reallocates. Appends as much as fits in the
+   current capacity (see `osocap()`), drops the rest, and returns the number of
+   chars that were dropped. It can't fail, so its cost is predictable. If `s`
+   is null, nothing fits.
+
+   Truncation happens at a byte boundary, so it can cut a UTF-8 sequence in
+   half.
+
+   oso *field = NULL;
+   osoensurecap(&field, 8);
+   osocatbounded(field, "abcdefghij"); // Returns 2, field is "abcdefgh" */
+   OSO_NONNULL((2));
+
+size_t
+osocatlenbounded(oso *s, char const *cstr, size_t len)
+/* Like `osocatbounded()`, but you specify the length for the right side. */
+   OSO_NONNULL((2));
+
+size_t
+osocatprintfbounded(oso *s, char const *fmt, ...)
+/* Like `osocatbounded()`, but do it with a printf. Returns the number of chars
+   of formatted output that didn't fit. */
+   OSO_NONNULL((2)) OSO_PRINTF(2, 3);
+
+size_t
+osocatvprintfbounded(oso *s, char const *fmt, va_list ap)
+/* Like `osocatbounded()`, but do it with a vprintf. */
+   OSO_NONNULL((2)) OSO_PRINTF(2, 0);
+
+int
+osoformatregister(char const *name, int (*fn)(oso **p, va_list *ap))
+/* Adds a custom conversion specifier, written `%{name}`, to the printf
+   functions that append to or replace an oso. When it's used, `fn` is called
+   to append the output straight onto `*p`, without any temporary strings. It
+   takes its own arguments with `va_arg(*ap, type)`, and returns 1 on success
+   or the result of a failed oso call (0.) Registering a name again replaces
+   its function.
+
+   Returns 0 if the name is empty, longer than 31 chars, or contains `}`, or if
+   32 names are already registered. Register everything at startup, before any
+   other threads are formatting. Until something is registered, formats
+   aren't scanned for `%{` at all, and after that, formats without it are
+   only scanned, not walked. An unknown `%{name}` is written out as is. The
+   printf functions of `oso_writer` and the bounded printf functions don't
+   look for custom specifiers. Compilers that check printf formats don't know
+   about them either, so you may need to quiet -Wformat where you use them.
+
+   The standard conversions around them work as usual, with every length
+   modifier, including `%n` through a pointer of the modifier's size. A
+   `long double` for `%Lf` and the like is printed at double precision.
+
+   static int
+   fmtipv4(oso **p, va_list *ap) {
+     unsigned long ip = va_arg(*ap, unsigned long);
+     return osocatprintf(p, "%lu.%lu.%lu.%lu", ip >> 24, ip >> 16 & 255,
+                         ip >> 8 & 255, ip & 255);
+   }
+
+   osoformatregister("ipv4", fmtipv4);
+   osocatprintf(&s, "from %{ipv4} port %d", addr, port); */
+   OSO_NONNULL((1, 2));
+
+int
 osoensurecap(oso **p, size_t cap)
 /* Ensure that the oso has at least `cap` memory allocated for its capacity.
    The capacity is the number of characters it can hold in its allocated
@@ -165,6 +331,8 @@ osoensurecap(oso **p, size_t cap)
   
    This function doesn't care about the position of the null terminator in the
    existing contents or the length number -- only the heap memory allocation.
+   It grows the allocation to exactly `cap`, so use it when you know the final
+   size.
 
    oso *drink = NULL;
    char const *cstring = "horchata";
@@ -176,7 +344,7 @@ osoensurecap(oso **p, size_t cap)
    OSO_NONNULL((1));
 
 
-void
+int
 osomakeroomfor(oso **p, size_t len)
 /* Ensure that the oso has enough memory allocated for an additional `len`
    characters, not counting the null terminator.
@@ -185,7 +353,10 @@ osomakeroomfor(oso **p, size_t len)
    that's currently 10 characters in length, call `osomakeroomfor(myoso, 5);`.
 
    This only adjusts the heap memory allocation, not the null terminator or
-   length number.
+   length number. When it has to grow, it at least doubles the capacity (up to
+   the most an oso can hold), so appending a little at a time only reallocates
+   a logarithmic number of times. All of the appending functions grow through
+   it.
 
    Both `osoensurecap()` and `osomakeroomfor()` can be used to avoid repeated
    heap reallactions by allocating it all at once before doing other
@@ -206,6 +377,28 @@ osomakeroomfor(oso **p, size_t len)
    OSO_NONNULL((1));
 
 
+oso *
+osoinitbuf(void *buf, size_t size);
+/* Sets up an empty oso in memory that you provide, like an array on the
+   stack, and returns it. You can use it with all of the oso functions, and
+   they'll write into your memory without allocating anything. If it ever
+   needs more room than you gave it, the contents are copied to the heap, and
+   from then on it's a regular oso.
+
+   Either way, call `osofree()` when you're done with it. It knows not to free
+   your memory. Some of `size` is used for bookkeeping, so the capacity will
+   be a little less than `size`. Returns null if `size` is too small to hold
+   even an empty string.
+
+   The memory must be suitably aligned, so declare it as an array of
+   `size_t`, and it must stay valid for as long as the oso is using it.
+
+   size_t storage[16];
+   oso *s = osoinitbuf(storage, sizeof storage);
+   osoputprintf(&s, "%d items", count);  // No allocation
+   puts((char *)s);
+   osofree(s); */
+
 void
 osoclear(oso **p)
 /* Sets the length number to 0, and write a null terminator at position 0.
@@ -236,7 +429,9 @@ osowipe(oso **p)
 
 void
 osopokelen(oso *s, size_t len)
-/* Manually updates length field. Doesn't do anything else for you. */
+/* Manually updates length field. Doesn't do anything else for you, except
+   forget the cached hash (see `osohash()`). If you modify the contents through
+   a `char *` cast, call this afterwards, even if the length didn't change. */
    OSO_NONNULL((1));
 
 size_t
@@ -261,6 +456,30 @@ osotrim(oso *s, char const *cut_set)
 /* Remove the characters in `cut_set` from the beginning and ending of `s`. */
    OSO_NONNULL((2));
 
+int
+osoinsert(oso **p, size_t pos, char const *cstr, size_t len)
+/* Inserts `len` characters from `cstr` at position `pos`, moving the rest of
+   the string to the right. If `pos` is past the end, it appends.
+
+   oso *sandwich = NULL;
+   osoput(&sandwich, "ham on rye");
+   osoinsert(&sandwich, 3, " and swiss", 10);
+   puts((char *)sandwich); "ham and swiss on rye" */
+   OSO_NONNULL((1, 3));
+
+void
+osoerase(oso *s, size_t pos, size_t len);
+/* Removes `len` characters starting at position `pos`, moving the rest of the
+   string to the left. The range is clamped to the end of the string. This
+   never reallocates. */
+
+int
+ososplice(oso **p, size_t pos, size_t del_len, char const *cstr, size_t len)
+/* Replaces `del_len` characters starting at position `pos` with `len`
+   characters from `cstr`. Does at most one reallocation and one move of the
+   tail of the string. */
+   OSO_NONNULL((1, 4));
+
 void
 ososwap(oso **a, oso **b)
 /* Swaps the two pointers. Why bother making a function for this? In case you
@@ -268,6 +487,761 @@ ososwap(oso **a, oso **b)
    debug code in the definition. */
    OSO_NONNULL((1, 2));
 
+int
+osoutf8valid(oso const *s);
+/* Returns 1 if the contents are valid UTF-8, or 0 if not. Overlong encodings,
+   surrogates, code points past U+10FFFF and truncated sequences are invalid.
+   A null or empty oso is valid. Uses SIMD when it's available. */
+
+size_t
+osoutf8count(oso const *s);
+/* Number of code points in the string, assuming it's valid UTF-8. (It counts
+   the bytes that aren't UTF-8 continuation bytes.) */
+
+int
+osocatutf8len(oso **p, char const *cstr, size_t len)
+/* Like `osocatlen()`, but validates the right side as UTF-8 while copying it,
+   so the data is only read once. Returns 1 if it was appended. Returns 0 if
+   the right side isn't valid UTF-8, in which case the left side keeps its
+   original contents, or if an allocation failed. */
+   OSO_NONNULL((1, 2));
+
+int
+osoeq(oso const *a, oso const *b);
+/* Returns 1 if the two strings have the same contents, otherwise 0. The
+   lengths are compared first, so strings with different lengths are rejected
+   without looking at their contents. Embedded null characters are compared
+   like any other character. Null is the same as an empty string. */
+
+int
+osocmp(oso const *a, oso const *b);
+/* Like `strcmp()`, but uses the stored lengths instead of scanning for null
+   terminators, so it works with embedded null characters. Returns a negative
+   number, 0, or a positive number if `a` sorts before, the same as, or after
+   `b`. Null is the same as an empty string. */
+
+int
+osostartswith(oso const *s, oso const *prefix);
+/* Returns 1 if `s` begins with `prefix`, otherwise 0. Every string starts
+   with an empty or null prefix. */
+
+int
+osoendswith(oso const *s, oso const *suffix);
+/* Returns 1 if `s` ends with `suffix`, otherwise 0. */
+
+oso_u64
+osohash(oso const *s);
+/* Returns a 64-bit hash of the contents, for use as a hash table key. It's
+   the same on every platform, but it may change in a future version of the
+   library, so don't store it.
+
+   If oso89.c is compiled with `OSO_CACHE_HASH` defined, each string's header
+   gets room for a cached hash. It's computed on the first call and returned
+   directly after that, until one of the oso functions modifies the string.
+   `osoeq()` also uses cached hashes to reject unequal strings early. The
+   cached value is written by `osohash()` even though the string is `const`,
+   so don't call it on the same string from more than one thread at a time. */
+
+void
+ososort(oso **arr, size_t n)
+/* Sorts an array of `n` strings in place, in the same order as `osocmp()`.
+   It's a radix-style sort that uses the stored lengths and compares a machine
+   word of each string at a time, which is much faster than `qsort()` with
+   `strcmp()` when there are lots of strings with shared prefixes. Null
+   elements are allowed and sort as empty strings.
+
+   It needs temporary memory for `n` small items. If that allocation fails, it
+   falls back to `qsort()`, so the array is always sorted. The stack it uses
+   grows with log2(n) at most, whatever the input.
+
+   When built with `OSO_THREADS`, arrays of at least `OSO_PARALLEL_SORT_MIN`
+   strings (default 65536) are partitioned into a few ranges per thread and
+   those are sorted on the thread pool. Without it, the sort is serial. */
+   OSO_NONNULL((1));
+
+void
+osotolower(oso *s);
+/* Converts the ASCII letters in the string to lowercase, in place. Other
+   bytes, including any non-ASCII UTF-8, are left alone. */
+
+void
+osotoupper(oso *s);
+/* Like `osotolower()`, but to uppercase. */
+
+int
+osocaseeq(oso const *a, oso const *b);
+/* Returns 1 if the two strings are equal when ASCII letters are compared
+   case-insensitively, otherwise 0. Strings with different lengths are never
+   equal, so this returns early without looking at the contents. Null is the
+   same as an empty string. */
+
+int
+osocasecmp(oso const *a, oso const *b);
+/* Like `strcasecmp()`, but for oso strings, and only folds ASCII. Returns a
+   negative number, 0, or a positive number if `a` sorts before, the same as,
+   or after `b`. Null is the same as an empty string. */
+
+int
+osocatjsonesc(oso **p, char const *cstr, size_t len)
+/* Like `osocatlen()`, but escapes the right side for use inside a JSON string
+   literal. Quotes, backslashes and control characters are escaped. Other
+   characters, including non-ASCII UTF-8, are copied as-is.
+
+   These escaping functions find the characters that need escaping 16 at a
+   time and copy everything between them in bulk. They make room for the
+   worst-case expansion up front, so they only reallocate once.
+
+   oso *json = NULL;
+   char const *name = "say \"hi\"";
+   osoput(&json, "{\"name\": \"");
+   osocatjsonesc(&json, name, strlen(name));
+   osocat(&json, "\"}");
+   puts((char *)json); {"name": "say \"hi\""} */
+   OSO_NONNULL((1, 2));
+
+int
+osocathtmlesc(oso **p, char const *cstr, size_t len)
+/* Like `osocatjsonesc()`, but escapes `&`, `<`, `>`, `"` and `'` as HTML
+   entities, so the result is safe in element content and quoted
+   attributes. */
+   OSO_NONNULL((1, 2));
+
+int
+osocaturlenc(oso **p, char const *cstr, size_t len)
+/* Like `osocatjsonesc()`, but percent-encodes everything except the
+   characters that are unreserved in URLs (letters, digits, `-`, `.`, `_` and
+   `~`). */
+   OSO_NONNULL((1, 2));
+
+int
+osocaturldec(oso **p, char const *cstr, size_t len)
+/* Like `osocatlen()`, but decodes percent-encoded characters in the right
+   side. `+` is not treated as a space. Returns 1 on success. Returns 0 if
+   there's a `%` that isn't followed by two hex digits, in which case the left
+   side keeps its original contents, or if an allocation failed. */
+   OSO_NONNULL((1, 2));
+
+int
+osocatcesc(oso **p, char const *cstr, size_t len)
+/* Like `osocatjsonesc()`, but escapes the right side for use inside a C
+   string literal. Control characters without a short escape are written as
+   three octal digits. */
+   OSO_NONNULL((1, 2));
+
+int
+osocatbase64(oso **p, char const *cstr, size_t len)
+/* Like `osocatlen()`, but appends the right side encoded as base64, with
+   padding. The exact output size is reserved up front and the encoded text
+   is written directly into the string, using SIMD when it's available. */
+   OSO_NONNULL((1, 2));
+
+int
+osocatbase64dec(oso **p, char const *cstr, size_t len)
+/* Like `osocatlen()`, but decodes base64 from the right side. Padding is
+   optional. Returns 1 on success. Returns 0 if the right side isn't valid
+   base64, in which case the left side keeps its original contents (unlike
+   allocation failures), or if an allocation failed. */
+   OSO_NONNULL((1, 2));
+
+int
+osocathex(oso **p, char const *cstr, size_t len)
+/* Like `osocatbase64()`, but encodes each byte as two lowercase hex
+   digits. */
+   OSO_NONNULL((1, 2));
+
+int
+osocathexdec(oso **p, char const *cstr, size_t len)
+/* Like `osocatbase64dec()`, but decodes pairs of hex digits, in either
+   case. */
+   OSO_NONNULL((1, 2));
+
+int
+osofill(oso **p, char c, size_t n)
+/* Appends `n` copies of the character `c`. Returns 1 on success, or 0 if an
+   allocation failed.
+
+   osoput(&s, "id");
+   osofill(&s, ' ', 6); // "id      " */
+   OSO_NONNULL((1));
+
+OSO_INLINE int
+osocatchar(oso **p, char c)
+/* Appends the character `c`. Returns 1 on success, or 0 if an allocation
+   failed. The check for room is inlined, so this is cheap enough to call once
+   per character in a loop. It only calls into oso89.c when the string is
+   full.
+
+   for (i = 0; i < n; i++) osocatchar(&s, digits[i]); */
+   OSO_NONNULL((1));
+
+OSO_INLINE int
+osocatchars(oso **p, char c, size_t n)
+/* Like `osofill()`, but the check for room is inlined, like `osocatchar()`.
+
+   osocatchars(&s, '-', depth); */
+   OSO_NONNULL((1));
+
+int
+osoconcat(oso **p, oso const *const *shards, size_t n)
+/* Appends all `n` shards, in order, onto the left side. Space for all of them
+   is made at once. Any of the shards can be null. Returns 1 on success, or 0
+   if an allocation failed. With `OSO_THREADS`, big concatenations are copied
+   on the thread pool.
+
+   oso *parts[3] = {NULL, NULL, NULL};
+   osoput(&parts[0], "pan");
+   osoput(&parts[2], "cake");
+   osoconcat(&out, (oso const *const *)parts, 3); // Appends "pancake" */
+   OSO_NONNULL((1, 2));
+
+int
+osoconcatprep(oso **p, oso const *const *shards, size_t n, size_t *out_base)
+/* The first step of doing `osoconcat()` with your own threads. Makes room for
+   all of the shards and sets the new length and null terminator, but doesn't
+   copy anything yet. `*out_base` is set to where the first shard goes, which
+   is the old length. Then call `osoconcatpart()` once for each part, from
+   whichever threads you like, and wait for them all to finish.
+
+   Returns 1 on success, or 0 if an allocation failed. */
+   OSO_NONNULL((1, 2, 4));
+
+void
+osoconcatpart(oso *s, size_t base, oso const *const *shards, size_t n,
+              size_t part, size_t parts)
+/* Copies part number `part` of `parts` after `osoconcatprep()`. The parts are
+   split by bytes, not by shards, so each one does the same amount of copying
+   even when the shards are different sizes. The parts don't overlap, so they
+   can run at the same time. Nothing else may use `s` or the shards until
+   they're all done. If `part` isn't less than `parts`, nothing is copied.
+
+   // In worker thread i of 8:
+   osoconcatpart(out, base, shards, n, i, 8); */
+   OSO_NONNULL((1, 3));
+
+void
+osopartrange(size_t count, size_t parts, size_t part, size_t *out_begin,
+             size_t *out_end)
+/* Splits `count` items into `parts` nearly equal contiguous ranges, and gives
+   the half-open range for part number `part`. Useful for handing records out
+   to the threads that build the shards. `part` should be less than `parts`.
+   If it isn't, including when `parts` is 0, the range is empty.
+
+   size_t begin, end;
+   osopartrange(num_records, num_threads, thread_index, &begin, &end);
+   for (i = begin; i < end; i++) osocatprintf(&shard, ...); */
+   OSO_NONNULL((4, 5));
+
+int
+osotoi64(char const *cstr, size_t len, oso_i64 *out, size_t *out_end)
+/* Parses a decimal integer from the start of `cstr`, which is `len` chars and
+   doesn't need to be null-terminated. An optional `+` or `-` sign and then
+   digits are accepted. Leading whitespace isn't skipped, and the locale
+   doesn't matter. `*out_end` is set to the number of chars used, so you can
+   tell where the number ended. It can be null if you don't care.
+
+   Returns 1 on success. Returns 0 if there's no number at the start, in which
+   case `*out` is 0 and `*out_end` is 0, or if the number doesn't fit, in which
+   case `*out` is clamped to the min or max and `*out_end` is still after the
+   last digit.
+
+   oso_i64 n;
+   size_t end;
+   osotoi64("-42,17", 6, &n, &end); // Returns 1, n is -42, end is 3 */
+   OSO_NONNULL((1, 3));
+
+int
+osotou64(char const *cstr, size_t len, oso_u64 *out, size_t *out_end)
+/* Like `osotoi64()`, but for unsigned numbers. A `-` sign isn't accepted. */
+   OSO_NONNULL((1, 3));
+
+int
+osotodouble(char const *cstr, size_t len, double *out, size_t *out_end)
+/* Like `osotoi64()`, but parses a decimal floating point number, like `-1.5`,
+   `.25`, `3.` or `6.02e23`. The decimal point is always `.`, no matter the
+   locale. Hex, `inf` and `nan` aren't accepted. The result is correctly
+   rounded, however many digits there are, and nothing is allocated. If the
+   exponent is there but has no digits, like `5e`, the number ends before the
+   `e`.
+
+   Returns 0 if there's no number, or if it's too big for a double, in which
+   case `*out` is set to infinity with the right sign. Numbers too small for a
+   double become zero and still succeed. */
+   OSO_NONNULL((1, 3));
+
+int
+osocatdouble(oso **p, double d)
+/* Appends `d` with the fewest digits that will read back as exactly the same
+   double, without `%.17g`-style noise. The decimal point is always `.`, no
+   matter the locale. The output is in plain notation when it's reasonably
+   short and in exponent notation otherwise, following the same rules as
+   JavaScript, so it's also valid JSON. Infinity and NaN are written as `inf`,
+   `-inf` and `nan`, which aren't. Returns 1 on success, or 0 if an allocation
+   failed.
+
+   osocatdouble(&s, 0.1);    // "0.1"
+   osocatdouble(&s, 1e20);   // "100000000000000000000"
+   osocatdouble(&s, 1e21);   // "1e+21"
+   osocatdouble(&s, 1.5e-7); // "1.5e-7" */
+   OSO_NONNULL((1));
+
+typedef struct oso_rope oso_rope;
+/* A rope is a balanced tree of `oso` leaf chunks. Use it instead of a plain
+   `oso` when you need to insert or erase in the middle of very large strings,
+   where moving the tail of a flat buffer on every edit would be too slow.
+
+   Like `oso *`, you can use null as an empty `oso_rope *`. The functions that
+   change a rope return 1 on success and 0 if an allocation failed, in which
+   case the whole rope is freed and the `oso_rope *` is set to null. With
+   OSO_KEEP_ON_ALLOC_FAILURE, the rope is left as it was instead. (An edit
+   then allocates everything it might need before it starts, which costs a
+   few extra allocations per edit.)
+
+   oso_rope *doc = NULL;
+   oso *flat = NULL;
+   osoropeinsert(&doc, 0, "ham and eggs", 12);
+   osoropeinsert(&doc, 4, "cheese ", 7);
+   osoputrope(&flat, doc);
+   puts((char *)flat); "ham cheese and eggs" */
+
+int
+osoropeinsert(oso_rope **p, size_t pos, char const *cstr, size_t len)
+/* Inserts `len` characters from `cstr` at position `pos` in the rope. If
+   `pos` is past the end of the rope, the characters are appended. */
+   OSO_NONNULL((1, 3));
+
+int
+osoropeerase(oso_rope **p, size_t pos, size_t len)
+/* Removes `len` characters starting at position `pos`. The range is clamped
+   to the end of the rope. */
+   OSO_NONNULL((1));
+
+int
+osoropecat(oso_rope **p, oso_rope *other)
+/* Appends the rope `other` onto the end of the left side. This takes
+   ownership of `other` -- don't use or free it after the call. (If it fails
+   with OSO_KEEP_ON_ALLOC_FAILURE, both ropes are left alone, and `other` is
+   still yours.) */
+   OSO_NONNULL((1));
+
+int
+osoropeeach(oso_rope const *r,
+            int (*fn)(char const *chunk, size_t len, void *user), void *user)
+/* Calls `fn` for each leaf chunk of the rope, in order. If `fn` returns
+   non-zero, iteration stops and that value is returned. Otherwise, returns 0.
+   The chunks are not null-terminated. */
+   OSO_NONNULL((2));
+
+size_t
+osoropelen(oso_rope const *r);
+/* Number of characters in the rope. */
+
+void
+osoropefree(oso_rope *r);
+/* Frees the rope and all of its leaves. Calling with null is allowed. */
+
+int
+osoputrope(oso **p, oso_rope const *r)
+/* Like `osoput()`, but the right side is a rope. The destination is sized
+   with a single allocation before the leaves are copied in. */
+   OSO_NONNULL((1));
+
+int
+osocatrope(oso **p, oso_rope const *r)
+/* Like `osocat()`, but the right side is a rope. */
+   OSO_NONNULL((1));
+
+typedef struct oso_map oso_map;
+/* A hash map with `oso *` keys and `void *` values. It's an open addressing
+   table that probes 16 slots at a time using SIMD, and uses `osohash()`, so
+   building with `OSO_CACHE_HASH` means keys are never rehashed when the table
+   grows.
+
+   The map owns its keys. When you insert a key, the map takes it without
+   copying it, and frees it when the entry is erased or the map is freed.
+   Values are yours to manage.
+
+   Like `oso *`, you can use null as an empty `oso_map *`. If an allocation
+   fails, the map and all of its keys are freed and the `oso_map *` is set to
+   null. With OSO_KEEP_ON_ALLOC_FAILURE, the map is left as it was instead.
+
+   oso_map *ages = NULL;
+   oso *key = NULL;
+   void **slot;
+   osoput(&key, "ferret");
+   *osomapset(&ages, key) = &some_ferret_age;  // The map owns `key` now
+   slot = osomapgetlen(ages, "ferret", 6);
+   if (slot) printf("%d\n", *(int *)*slot);
+   osomapfree(ages); */
+
+void **
+osomapset(oso_map **p, oso *key)
+/* Finds or inserts the entry for `key`, and returns a pointer to its value so
+   that you can read or assign it. New entries start with a null value.
+
+   This always takes ownership of `key`. If the map already had an equal key,
+   the one you passed in is freed. Returns null if an allocation failed. */
+   OSO_NONNULL((1));
+
+void **
+osomapget(oso_map const *m, oso const *key);
+/* Returns a pointer to the value for `key`, or null if it isn't in the map.
+   The map doesn't take ownership of `key`. */
+
+void **
+osomapgetlen(oso_map const *m, char const *cstr, size_t len)
+/* Like `osomapget()`, but you look up with a buffer and a length instead of
+   an oso. */
+   OSO_NONNULL((2));
+
+int
+osomaperase(oso_map *m, oso const *key);
+/* Removes the entry for `key` and frees the map's copy of the key. Returns 1
+   if it was found, or 0 if not. */
+
+int
+osomapreserve(oso_map **p, size_t count)
+/* Makes room for `count` entries, so that inserting up to that many won't
+   reallocate. Returns 1 on success. If the room can't be allocated, returns
+   0 and leaves the map as it was, including leaving `*p` null if it was. */
+   OSO_NONNULL((1));
+
+size_t
+osomaplen(oso_map const *m);
+/* Number of entries in the map. */
+
+int
+osomapnext(oso_map const *m, size_t *iter, oso const **out_key,
+           void **out_value)
+/* Iterates over the entries, in no particular order. Start with `*iter` set
+   to 0. Each call stores the next entry in `out_key` and `out_value` (either
+   can be null) and returns 1, or returns 0 when there are no more entries.
+   You can erase the current entry while iterating, but don't insert.
+
+   size_t iter = 0;
+   oso const *key;
+   void *value;
+   while (osomapnext(map, &iter, &key, &value)) puts((char *)key); */
+   OSO_NONNULL((2));
+
+void
+osomapfree(oso_map *m);
+/* Frees the map and all of its keys, but not the values. Calling with null is
+   allowed. */
+
+typedef struct oso_vec oso_vec;
+/* An array of strings that are all stored back-to-back in one buffer, with a
+   table of offsets, instead of being allocated separately. Use it for large
+   batches of strings that you scan in order, or that you want to throw away
+   all at once.
+
+   Each element is followed by a null terminator, so `osovecat()` gives you a
+   C-string. Elements can't be modified in place, only pushed and popped.
+
+   Like `oso *`, you can use null as an empty `oso_vec *`. The functions that
+   add to a vec return 1 on success and 0 if an allocation failed. Then the
+   vec is freed and the `oso_vec *` is set to null, or with
+   OSO_KEEP_ON_ALLOC_FAILURE, the vec is left as it was.
+
+   oso_vec *names = NULL;
+   size_t i;
+   osovecpush(&names, "alice");
+   osovecpush(&names, "bob");
+   for (i = 0; i < osoveccount(names); i++)
+     puts(osovecat(names, i, NULL));
+   osovecfree(names); */
+
+int
+osovecpush(oso_vec **p, char const *cstr)
+/* Appends a copy of the string to the end of the vec. */
+   OSO_NONNULL((1, 2));
+
+int
+osovecpushlen(oso_vec **p, char const *cstr, size_t len)
+/* Like `osovecpush()`, but you specify the length. */
+   OSO_NONNULL((1, 2));
+
+int
+osovecpushoso(oso_vec **p, oso const *s)
+/* Like `osovecpush()`, but the string is an oso. */
+   OSO_NONNULL((1));
+
+void
+osovecpop(oso_vec *v);
+/* Removes the last element, if there is one. */
+
+void
+osovecclear(oso_vec *v);
+/* Removes all of the elements, but keeps the allocated memory. */
+
+int
+osovecreserve(oso_vec **p, size_t count, size_t total_len)
+/* Makes room for `count` more elements with `total_len` more characters
+   between them, so that pushing them won't reallocate. */
+   OSO_NONNULL((1));
+
+size_t
+osoveccount(oso_vec const *v);
+/* Number of elements in the vec. */
+
+char const *
+osovecat(oso_vec const *v, size_t i, size_t *out_len)
+/* Returns element `i`, which must be less than `osoveccount()`. If `out_len`
+   isn't null, the element's length is stored there. The pointer is only valid
+   until the vec is next modified. */
+   OSO_NONNULL((1));
+
+int
+osovecget(oso **p, oso_vec const *v, size_t i)
+/* Like `osoput()`, but copies element `i` of the vec, so that you have your
+   own standalone copy of it. */
+   OSO_NONNULL((1, 2));
+
+void
+osovecfree(oso_vec *v);
+/* Frees the vec and all of its elements. Calling with null is allowed. */
+
+typedef struct oso_writer {
+  oso *buf;
+  size_t high_water;
+  int fd, err;
+} oso_writer;
+/* A buffered writer for a file descriptor. Output is collected in an oso
+   until it reaches `high_water` characters, and then written out, after
+   which the buffer is reused. Writes bigger than `high_water` aren't copied
+   into the buffer at all -- they're sent with `writev()` along with whatever
+   is already buffered, in one system call.
+
+   Only available on POSIX systems. The file descriptor should be in blocking
+   mode.
+
+   If a write fails, or an allocation fails, the error number is stored in
+   `err`, and everything written after that is discarded. You can check `err`
+   whenever you like, or just at the end, from `osowriterflush()`. Each of
+   the write functions also returns 0 or the error number. Don't touch the
+   other fields.
+
+   With OSO_KEEP_ON_ALLOC_FAILURE, an allocation failure loses only the
+   write that caused it: that call returns ENOMEM, but `err` isn't set and
+   what was buffered before is kept. A printf that fails part way may have
+   written some of its output.
+
+   oso_writer w;
+   osowriterinit(&w, STDOUT_FILENO, 1 << 16);
+   osowriteprintf(&w, "%d bottles\n", 99);
+   osowrite(&w, "of pop\n");
+   if (osowriterflush(&w)) perror("stdout");
+   osowriterfree(&w); */
+
+void
+osowriterinit(oso_writer *w, int fd, size_t high_water)
+/* Sets up a writer. It doesn't allocate anything until you write to it. */
+   OSO_NONNULL((1));
+
+int
+osowrite(oso_writer *w, char const *cstr)
+/* Writes the null-terminated string to the writer. */
+   OSO_NONNULL((1, 2));
+
+int
+osowritelen(oso_writer *w, char const *cstr, size_t len)
+/* Like `osowrite()`, but you specify the length. */
+   OSO_NONNULL((1, 2));
+
+int
+osowriteoso(oso_writer *w, oso const *s)
+/* Like `osowrite()`, but the string is an oso. */
+   OSO_NONNULL((1));
+
+int
+osowriteprintf(oso_writer *w, char const *fmt, ...)
+/* Like `osocatprintf()`, but into the writer. The formatted output is
+   flushed as it's produced, so formatting a huge string won't make the
+   buffer grow past `high_water`. */
+   OSO_NONNULL((1, 2)) OSO_PRINTF(2, 3);
+
+int
+osowritevprintf(oso_writer *w, char const *fmt, va_list ap)
+/* Like `osowriteprintf()`, but with a `va_list`. */
+   OSO_NONNULL((1, 2)) OSO_PRINTF(2, 0);
+
+int
+osowriterflush(oso_writer *w)
+/* Writes out everything that's buffered. Returns 0 on success, or the error
+   number from the first failure. */
+   OSO_NONNULL((1));
+
+void
+osowriterfree(oso_writer *w)
+/* Frees the writer's buffer, without flushing it. */
+   OSO_NONNULL((1));
+
+int
+osowritefd(int fd, oso const *const *strs, size_t n)
+/* Writes `n` strings to a file descriptor, batching them into as few
+   `writev()` calls as possible, and handling partial writes. Null and empty
+   strings are skipped. Returns 0 on success, or an error number. Only
+   available on POSIX systems. */
+   OSO_NONNULL((2));
+
+typedef struct oso_logq {
+  void *head, *writer;
+} oso_logq;
+/* A queue for handing finished log buffers from many threads to one writer
+   thread, without locks. Each producer thread formats into its own buffer
+   with `osolog()`, which the library keeps in thread-local storage. When that
+   buffer gets big enough, the whole buffer is pushed onto the queue and the
+   thread starts a new one. The writer thread takes everything that's queued
+   at once and writes it out with as few `writev()` calls as possible, so the
+   more there is to write, the bigger the writes get.
+
+   Only available on POSIX systems with GCC or Clang atomics. The background
+   writer thread from `osologqstart()` also needs `OSO_THREADS` to be defined,
+   since that's what says the program is built with threads. (`OSO_THREADS=1`
+   is enough, and doesn't start any pool threads.) Without it, call
+   `osologqdrain()` from a thread of your own.
+
+   oso_logq q;                      // Shared
+   osologqinit(&q);
+   osologqstart(&q, log_fd);
+
+   osolog(&q, "request %d took %dms\n", id, ms);  // In each producer thread
+   osologflush();                   // Before each producer thread exits
+
+   osologqstop(&q);                 // After the producers are done */
+
+void
+osologqinit(oso_logq *q)
+/* Sets up an empty queue. */
+   OSO_NONNULL((1));
+
+int
+osologqstart(oso_logq *q, int fd)
+/* Starts a background thread that writes the queue's buffers to `fd` as they
+   arrive. Returns 0 on success, `EBUSY` if one is already running for this
+   queue, or another error number if the thread couldn't be started. Needs
+   `OSO_THREADS`. */
+   OSO_NONNULL((1));
+
+int
+osologqstop(oso_logq *q)
+/* Stops the background writer thread, waits for it, and writes whatever is
+   still queued. Call it after the producer threads are done pushing. Returns
+   0 on success, or the error number from the first failed write. Does nothing
+   and returns 0 if no writer is running. Needs `OSO_THREADS`. */
+   OSO_NONNULL((1));
+
+int
+osolog(oso_logq *q, char const *fmt, ...)
+/* Like `osocatprintf()` into the calling thread's own log buffer, including
+   the return value. When the buffer reaches `OSO_LOG_HIGH_WATER` characters
+   (default 65536), it's pushed onto the queue. The lines stay in the buffer
+   until then, so a quiet thread's lines can wait a while. Use
+   `osologflush()` to send them sooner.
+
+   Each thread's buffer is for one queue at a time. Logging to a different
+   queue flushes what's there to the old one first. */
+   OSO_NONNULL((1, 2)) OSO_PRINTF(2, 3);
+
+int
+osologflush(void);
+/* Pushes the calling thread's `osolog()` buffer onto its queue and frees the
+   buffer. Call it before a thread that used `osolog()` exits, or what's in
+   its buffer is lost and leaked. Returns 1 on success, or 0 if an allocation
+   failed, in which case the buffer is kept. */
+
+int
+osologprintf(oso_logq *q, oso **p, size_t high_water, char const *fmt, ...)
+/* Like `osolog()`, but into a buffer `p` that you keep yourself, which is
+   pushed once it reaches `high_water` characters. */
+   OSO_NONNULL((1, 2, 4)) OSO_PRINTF(4, 5);
+
+int
+osologqpush(oso_logq *q, oso **p)
+/* Pushes the buffer onto the queue, which takes ownership of it, and sets
+   `*p` to null. Empty buffers are left alone. Returns 1 on success. If an
+   allocation fails, returns 0 and leaves the buffer in `*p`. Safe to call
+   from any number of threads. */
+   OSO_NONNULL((1, 2));
+
+int
+osologqdrain(oso_logq *q, int fd)
+/* Takes all of the buffers that are currently queued, writes them to `fd` in
+   the order they were pushed, and frees them. Call this from only one thread
+   at a time, and not while a background writer is running. Returns 0 on
+   success, or an error number if writing failed (in which case the rest of
+   the buffers are discarded). */
+   OSO_NONNULL((1));
+
+void
+osologqfree(oso_logq *q)
+/* Frees anything still in the queue, without writing it. Stop the background
+   writer first, if there is one. */
+   OSO_NONNULL((1));
+
+oso *
+ososcratchget(void);
+/* Gets a temporary string from the calling thread's scratch pool. It's empty,
+   but it keeps the capacity it grew to the last time it was used, so building
+   something in it usually doesn't allocate. When the pool is empty, it
+   allocates a new string with room for OSO_SCRATCH_MIN_CAP chars (256 unless
+   defined when compiling oso89.c). Returns null, which is still a fine empty
+   oso, only if that allocation fails. Give it back with `ososcratchput()`
+   instead of freeing it.
+
+   oso *tmp = ososcratchget();
+   osoputprintf(&tmp, "%s/%s", dir, name);
+   use((char *)tmp);
+   ososcratchput(tmp); */
+
+void
+ososcratchput(oso *s);
+/* Returns a string to the calling thread's scratch pool, cleared. It doesn't
+   have to have come from `ososcratchget()`. If the pool already holds 8
+   strings, or the string's capacity is over OSO_SCRATCH_MAX_CAP (64 KB unless
+   defined when compiling oso89.c), it's freed instead, so the pool can't pin
+   down much memory. Calling with null is allowed.
+
+   The pool needs thread-local storage from the compiler (C11, GCC, Clang or
+   MSVC.) Without it, `ososcratchget()` always allocates a new string and
+   `ososcratchput()` always frees. */
+
+void
+ososcratchfree(void);
+/* Frees the strings in the calling thread's scratch pool. Call it before a
+   thread that used the pool exits, or they'll leak. */
+
 /* clang-format on */
+
+OSO_INLINE int
+osocatchar(oso **p, char c) {
+  char *s = (char *)*p;
+  if (s && OSO_IMPL_CAP(s) > OSO_IMPL_LEN(s)) {
+    s[OSO_IMPL_LEN(s)++] = c;
+    s[OSO_IMPL_LEN(s)] = '\0';
+    OSO_IMPL_DIRTY(s);
+    return 1;
+  }
+  return osofill(p, c, 1);
+}
+
+OSO_INLINE int
+osocatchars(oso **p, char c, size_t n) {
+  char *s = (char *)*p;
+  if (s && OSO_IMPL_CAP(s) - OSO_IMPL_LEN(s) >= n) {
+    char *end = s + OSO_IMPL_LEN(s);
+    size_t i;
+    for (i = 0; i < n; i++) end[i] = c;
+    end[n] = '\0';
+    OSO_IMPL_LEN(s) += n;
+    OSO_IMPL_DIRTY(s);
+    return 1;
+  }
+  return osofill(p, c, n);
+}
+
 #undef OSO_PRINTF
 #undef OSO_NONNULL
+#undef OSO_INLINE
+#undef OSO_IMPL_LEN
+#undef OSO_IMPL_CAP
+#undef OSO_IMPL_DIRTY
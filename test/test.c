@@ -0,0 +1,1546 @@
+/* Tests for oso89. Build and run them with `./tool test`.
+
+   oso89.c is included here instead of being compiled separately, so that
+   malloc() and realloc() can be made to fail on purpose. Each configuration
+   that `./tool test` builds runs the same checks, and most of them compare
+   against simple byte-at-a-time reference code, so the scalar and SIMD paths
+   have to agree with each other. */
+#if defined(__linux__)
+#define _GNU_SOURCE /* for fileno() and ftruncate(), and mremap() in oso89.c */
+#elif defined(__unix__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include <stdlib.h>
+
+static long test_allocs_left = -1; /* -1 means never fail */
+
+static void *
+test_malloc(size_t n) {
+  if (test_allocs_left == 0) return NULL;
+  if (test_allocs_left > 0) test_allocs_left--;
+  return malloc(n);
+}
+
+static void *
+test_realloc(void *p, size_t n) {
+  if (test_allocs_left == 0) return NULL;
+  if (test_allocs_left > 0) test_allocs_left--;
+  return realloc(p, n);
+}
+
+#define malloc(n) test_malloc(n)
+#define realloc(p, n) test_realloc(p, n)
+#include "oso89.c"
+#undef malloc
+#undef realloc
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static int test_failures;
+
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      test_failures++;                                                  \
+      fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #cond); \
+    }                                                                   \
+  } while (0)
+
+#define CHECKSTR(s, expected) \
+  CHECK(osolen(s) == strlen(expected) && !strcmp((char *)(s), (expected)))
+
+static unsigned long test_state = 0x2545F491u;
+
+static size_t
+rnd(size_t n) {
+  test_state ^= test_state << 13;
+  test_state ^= test_state >> 7;
+  test_state ^= test_state << 17;
+  test_state &= 0xFFFFFFFFu;
+  return n ? (size_t)(test_state % n) : 0;
+}
+
+static void
+rndbytes(char *buf, size_t len, char const *alphabet) {
+  size_t i, n = alphabet ? strlen(alphabet) : 256;
+  for (i = 0; i < len; i++)
+    buf[i] = alphabet ? alphabet[rnd(n)] : (char)rnd(256);
+}
+
+/* Lengths to try, so that every SIMD loop gets a tail of every size, and
+   there are a few long inputs too. */
+static size_t
+rndlen(void) {
+  switch (rnd(4)) {
+  case 0: return rnd(40);
+  case 1: return rnd(200);
+  case 2: return 64 * rnd(8) + rnd(3);
+  default: return rnd(3000);
+  }
+}
+
+static int
+sign(int x) {
+  return (x > 0) - (x < 0);
+}
+
+static void
+test_basics(void) {
+  oso *s = NULL;
+  size_t len, cap;
+  CHECK(osolen(s) == 0 && osocap(s) == 0 && osoavail(s) == 0);
+  CHECK(osoput(&s, "Hello World"));
+  CHECKSTR(s, "Hello World");
+  CHECK(osocat(&s, "!"));
+  CHECKSTR(s, "Hello World!");
+  CHECK(osoputprintf(&s, "%d %s", 5, "cucumbers"));
+  CHECKSTR(s, "5 cucumbers");
+  CHECK(osocatprintf(&s, " and %05.1f%%", 2.3));
+  CHECKSTR(s, "5 cucumbers and 002.3%");
+  osolencap(s, &len, &cap);
+  CHECK(len == osolen(s) && cap == osocap(s) && cap >= len);
+  CHECK(osoavail(s) == cap - len);
+  osoput(&s, "  \t trim me \n ");
+  osotrim(s, " \t\n");
+  CHECKSTR(s, "trim me");
+  osotrim(s, "trime ");
+  CHECKSTR(s, "");
+  osoput(&s, "abc");
+  osoclear(&s);
+  CHECKSTR(s, "");
+  CHECK(osocap(s) >= 3);
+  CHECK(osoensurecap(&s, 100) && osocap(s) >= 100);
+  CHECK(osomakeroomfor(&s, 200) && osocap(s) >= 200);
+  osowipe(&s);
+  CHECK(s == NULL);
+  osowipe(&s);
+}
+
+static void
+test_splice(void) {
+  char model[4096], ins[64];
+  size_t model_len = 0, i;
+  oso *s = NULL;
+  for (i = 0; i < 2000; i++) {
+    size_t pos = rnd(model_len + 4), del = rnd(20), len = rnd(sizeof ins);
+    size_t p = pos > model_len ? model_len : pos;
+    size_t d = del > model_len - p ? model_len - p : del;
+    rndbytes(ins, len, "abcdefghij");
+    switch (rnd(3)) {
+    case 0:
+      if (model_len + len >= sizeof model) continue;
+      CHECK(osoinsert(&s, pos, ins, len));
+      d = 0;
+      break;
+    case 1:
+      osoerase(s, pos, del);
+      len = 0;
+      break;
+    default:
+      if (model_len - d + len >= sizeof model) continue;
+      CHECK(ososplice(&s, pos, del, ins, len));
+      break;
+    }
+    if (p >= model_len && len == 0) d = 0;
+    memmove(model + p + len, model + p + d, model_len - p - d);
+    memcpy(model + p, ins, len);
+    model_len = model_len - d + len;
+    CHECK(osolen(s) == model_len);
+    CHECK(!memcmp(s ? (char *)s : "", model, model_len));
+    CHECK(!s || ((char *)s)[model_len] == '\0');
+  }
+  osofree(s);
+}
+
+static int
+ref_utf8valid(unsigned char const *s, size_t len) {
+  size_t i = 0;
+  while (i < len) {
+    unsigned long cp;
+    size_t n, k;
+    if (s[i] < 0x80) {
+      i++;
+      continue;
+    }
+    if ((s[i] & 0xE0) == 0xC0) n = 1, cp = s[i] & 0x1Fu;
+    else if ((s[i] & 0xF0) == 0xE0) n = 2, cp = s[i] & 0x0Fu;
+    else if ((s[i] & 0xF8) == 0xF0) n = 3, cp = s[i] & 0x07u;
+    else return 0;
+    if (len - i <= n) return 0;
+    for (k = 1; k <= n; k++) {
+      if ((s[i + k] & 0xC0) != 0x80) return 0;
+      cp = cp << 6 | (s[i + k] & 0x3Fu);
+    }
+    if (cp < (n == 1 ? 0x80u : n == 2 ? 0x800u : 0x10000u)) return 0;
+    if (cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) return 0;
+    i += n + 1;
+  }
+  return 1;
+}
+
+/* Mostly valid UTF-8 of every length, with an occasional broken byte. */
+static size_t
+rndutf8(unsigned char *buf, size_t max) {
+  size_t len = 0;
+  while (len + 4 <= max) {
+    unsigned long cp;
+    switch (rnd(4)) {
+    case 0: cp = (unsigned long)rnd(0x80); break;
+    case 1: cp = 0x80 + (unsigned long)rnd(0x780); break;
+    case 2: cp = 0x800 + (unsigned long)rnd(0xF800); break;
+    default: cp = 0x10000 + (unsigned long)rnd(0x100000); break;
+    }
+    if (cp < 0x80) {
+      buf[len++] = (unsigned char)cp;
+    } else if (cp < 0x800) {
+      buf[len++] = (unsigned char)(0xC0 | cp >> 6);
+      buf[len++] = (unsigned char)(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+      buf[len++] = (unsigned char)(0xE0 | cp >> 12);
+      buf[len++] = (unsigned char)(0x80 | ((cp >> 6) & 0x3F));
+      buf[len++] = (unsigned char)(0x80 | (cp & 0x3F));
+    } else {
+      buf[len++] = (unsigned char)(0xF0 | cp >> 18);
+      buf[len++] = (unsigned char)(0x80 | ((cp >> 12) & 0x3F));
+      buf[len++] = (unsigned char)(0x80 | ((cp >> 6) & 0x3F));
+      buf[len++] = (unsigned char)(0x80 | (cp & 0x3F));
+    }
+  }
+  len = rnd(len + 1);
+  if (len && rnd(2)) buf[rnd(len)] = (unsigned char)rnd(256);
+  return len;
+}
+
+static void
+test_utf8(void) {
+  unsigned char buf[3000];
+  size_t i, k;
+  oso *s = NULL, *t = NULL;
+  CHECK(osoutf8valid(NULL) && osoutf8count(NULL) == 0);
+  for (i = 0; i < 20000; i++) {
+    size_t len = rndutf8(buf, i % 10 ? 100 : sizeof buf), count = 0;
+    int valid = ref_utf8valid(buf, len);
+    osoputlen(&s, (char const *)buf, len);
+    CHECK(osoutf8valid(s) == valid);
+    for (k = 0; k < len; k++) count += (buf[k] & 0xC0) != 0x80;
+    CHECK(osoutf8count(s) == count);
+    osoput(&t, "x");
+    CHECK(osocatutf8len(&t, (char const *)buf, len) == valid);
+    if (valid) {
+      CHECK(osolen(t) == len + 1 && !memcmp((char *)t + 1, buf, len));
+    } else {
+      CHECKSTR(t, "x");
+    }
+  }
+  /* Each error right at the end of an input, so the tail handling sees it. */
+  for (i = 1; i < 80; i++) {
+    memset(buf, 'a', i);
+    buf[i - 1] = 0xE2;
+    osoputlen(&s, (char const *)buf, i);
+    CHECK(!osoutf8valid(s));
+  }
+  osofree(s);
+  osofree(t);
+}
+
+static void
+test_case(void) {
+  char a[3000], b[3000];
+  size_t i, k;
+  oso *s = NULL, *t = NULL;
+  for (i = 0; i < 3000; i++) {
+    size_t len = rndlen();
+    int res;
+    rndbytes(a, len, i % 2 ? NULL : "aAbBzZ@[`{09 \x80\xC1\xFF");
+    osoputlen(&s, a, len);
+    osotolower(s);
+    for (k = 0; k < len; k++)
+      CHECK(((char *)s)[k] == (a[k] >= 'A' && a[k] <= 'Z' ? a[k] + 32 : a[k]));
+    osoputlen(&s, a, len);
+    osotoupper(s);
+    for (k = 0; k < len; k++)
+      CHECK(((char *)s)[k] == (a[k] >= 'a' && a[k] <= 'z' ? a[k] - 32 : a[k]));
+    /* Same letters in a different case, with an occasional difference. */
+    for (k = 0; k < len; k++)
+      b[k] = (char)(((a[k] | 32) >= 'a' && (a[k] | 32) <= 'z' && rnd(2))
+                      ? a[k] ^ 32
+                      : a[k]);
+    if (len && rnd(2)) b[rnd(len)] = (char)rnd(256);
+    osoputlen(&s, a, len);
+    osoputlen(&t, b, len - (len && !rnd(8)));
+    res = 0;
+    for (k = 0; k < osolen(t) && !res; k++) {
+      int x = (unsigned char)a[k], y = (unsigned char)b[k];
+      if (x >= 'A' && x <= 'Z') x += 32;
+      if (y >= 'A' && y <= 'Z') y += 32;
+      res = x - y;
+    }
+    if (!res) res = osolen(s) == osolen(t) ? 0 : osolen(s) < osolen(t) ? -1 : 1;
+    CHECK(sign(osocasecmp(s, t)) == sign(res));
+    CHECK(sign(osocasecmp(t, s)) == -sign(res));
+    CHECK(osocaseeq(s, t) == !res);
+  }
+  CHECK(osocaseeq(NULL, NULL) && osocasecmp(NULL, NULL) == 0);
+  osofree(s);
+  osofree(t);
+}
+
+static void
+test_compare(void) {
+  oso *a = NULL, *b = NULL;
+  char buf[64];
+  size_t i;
+  CHECK(osoeq(NULL, NULL) && osocmp(NULL, NULL) == 0);
+  osoputlen(&a, "ab\0c", 4);
+  osoputlen(&b, "ab\0d", 4);
+  CHECK(!osoeq(a, b) && osocmp(a, b) < 0 && osocmp(b, a) > 0);
+  osoputlen(&b, "ab\0c", 4);
+  CHECK(osoeq(a, b) && osocmp(a, b) == 0 && osohash(a) == osohash(b));
+  osoputlen(&b, "ab", 2);
+  CHECK(!osoeq(a, b) && osocmp(b, a) < 0 && osostartswith(a, b));
+  CHECK(osostartswith(a, NULL) && osoendswith(a, NULL));
+  CHECK(!osostartswith(b, a) && !osoendswith(b, a));
+  osoputlen(&b, "\0c", 2);
+  CHECK(osoendswith(a, b));
+  osoclear(&b);
+  CHECK(osoeq(b, NULL) && osohash(b) == osohash(NULL));
+  for (i = 0; i < 2000; i++) {
+    size_t alen = rnd(20), blen = rnd(20), n;
+    int res;
+    rndbytes(buf, alen, "ab\x01");
+    osoputlen(&a, buf, alen);
+    rndbytes(buf, blen, "ab\x01");
+    osoputlen(&b, buf, blen);
+    n = alen < blen ? alen : blen;
+    res = memcmp(a, b, n);
+    if (!res) res = alen < blen ? -1 : alen > blen;
+    CHECK(sign(osocmp(a, b)) == sign(res));
+    CHECK(osoeq(a, b) == !res);
+    if (!res) CHECK(osohash(a) == osohash(b));
+  }
+  /* The hash is the same on every platform. */
+  osoput(&a, "hello, world");
+  CHECK(osohash(a) == ((oso_u64)0xA62FEBD6 << 32 | 0x4A684677));
+  CHECK(osohash(NULL) == ((oso_u64)0x0409638E << 32 | 0xE2BDE459));
+  for (i = 0; i < sizeof buf; i++) buf[i] = (char)i;
+  osoputlen(&a, buf, sizeof buf);
+  CHECK(osohash(a) == ((oso_u64)0xAE9AC4F9 << 32 | 0x962D6746));
+  /* A cached hash has to be forgotten by every change to the string. */
+  osoput(&a, "key");
+  osohash(a);
+  osocatchar(&a, 's');
+  osoput(&b, "keys");
+  CHECK(osohash(a) == osohash(b) && osoeq(a, b));
+  osotoupper(a);
+  CHECK(osohash(a) != osohash(b) && !osoeq(a, b));
+  osofree(a);
+  osofree(b);
+}
+
+static int
+test_qsortcmp(void const *a, void const *b) {
+  return osocmp(*(oso *const *)a, *(oso *const *)b);
+}
+
+static void
+test_sort(void) {
+  enum { N = 5000 };
+  static oso *arr[N], *ref[N];
+  char buf[40];
+  size_t i, n, round;
+  for (round = 0; round < 8; round++) {
+    n = round < 3 ? rnd(40) : N;
+    for (i = 0; i < n; i++) {
+      size_t len = rnd(sizeof buf);
+      arr[i] = NULL;
+      if (round >= 6) { /* already sorted, then reversed */
+        unsigned long k = (unsigned long)(round == 6 ? i : n - i);
+        osoputprintf(&arr[i], "prefix-%05lu", k);
+        continue;
+      }
+      if (rnd(50) == 0) continue; /* null sorts as empty */
+      rndbytes(buf, len, round % 2 ? "ab" : "aaaaaaaaaaaaaaaab\x01");
+      if (round == 5) memset(buf, 'x', len); /* lots of equal prefixes */
+      osoputlen(&arr[i], buf, len);
+    }
+    memcpy(ref, arr, n * sizeof(oso *));
+    qsort(ref, n, sizeof(oso *), test_qsortcmp);
+    ososort(arr, n);
+    for (i = 0; i < n; i++) CHECK(osoeq(arr[i], ref[i]));
+    for (i = 0; i < n; i++) osofree(arr[i]);
+  }
+}
+
+static int
+test_ropecb(char const *chunk, size_t len, void *user) {
+  oso **out = (oso **)user;
+  CHECK(len > 0);
+  osocatlen(out, chunk, len);
+  return 0;
+}
+
+static void
+test_rope(void) {
+  static char model[200000];
+  char ins[5000];
+  size_t model_len = 0, i;
+  oso_rope *r = NULL, *other = NULL;
+  oso *flat = NULL, *each = NULL;
+  for (i = 0; i < 3000; i++) {
+    size_t pos = rnd(model_len + 10), len;
+    if (rnd(3) || model_len < 1000) {
+      len = rnd(8) ? rnd(20) : rnd(sizeof ins);
+      if (model_len + len > sizeof model) continue;
+      rndbytes(ins, len, "abcdefghijklmnopqrstuvwxyz");
+      osoropeinsert(&r, pos, ins, len);
+      if (pos > model_len) pos = model_len;
+      memmove(model + pos + len, model + pos, model_len - pos);
+      memcpy(model + pos, ins, len);
+      model_len += len;
+    } else {
+      len = rnd(3000);
+      osoropeerase(&r, pos, len);
+      if (pos > model_len) pos = model_len;
+      if (len > model_len - pos) len = model_len - pos;
+      memmove(model + pos, model + pos + len, model_len - pos - len);
+      model_len -= len;
+    }
+    CHECK(osoropelen(r) == model_len);
+    if (i % 100) continue;
+    CHECK(osoputrope(&flat, r));
+    CHECK(osolen(flat) == model_len && !memcmp(flat, model, model_len));
+    osoclear(&each);
+    osoropeeach(r, test_ropecb, &each);
+    CHECK(osoeq(each, flat));
+  }
+  osoropeinsert(&other, 0, "tail", 4);
+  osoropecat(&r, other);
+  memcpy(model + model_len, "tail", 4);
+  model_len += 4;
+  osoput(&flat, ">");
+  CHECK(osocatrope(&flat, r));
+  CHECK(osolen(flat) == model_len + 1 && !memcmp((char *)flat + 1, model,
+                                                 model_len));
+  osoropefree(r);
+  osoropefree(NULL);
+  osofree(flat);
+  osofree(each);
+}
+
+static void
+test_map(void) {
+  enum { N = 3000 };
+  static char seen[N];
+  oso_map *m = NULL;
+  oso *key = NULL;
+  char buf[32];
+  size_t i, iter = 0, count = 0;
+  oso const *k;
+  void *v;
+  CHECK(osomapget(NULL, NULL) == NULL && osomaplen(NULL) == 0);
+  for (i = 0; i < N; i++) {
+    int n = snprintf(buf, sizeof buf, "key%lu", (unsigned long)i);
+    key = NULL;
+    osoputlen(&key, buf, (size_t)n);
+    *osomapset(&m, key) = (void *)(seen + i);
+  }
+  CHECK(osomaplen(m) == N);
+  /* Setting an existing key frees the new one and keeps the entry. */
+  key = NULL;
+  osoput(&key, "key7");
+  CHECK(*osomapset(&m, key) == (void *)(seen + 7));
+  key = NULL;
+  CHECK(osomaplen(m) == N);
+  for (i = 0; i < N; i += 2) {
+    int n = snprintf(buf, sizeof buf, "key%lu", (unsigned long)i);
+    osoputlen(&key, buf, (size_t)n);
+    CHECK(osomaperase(m, key));
+    CHECK(!osomaperase(m, key));
+  }
+  osofree(key);
+  CHECK(osomaplen(m) == N / 2);
+  for (i = 0; i < N; i++) {
+    int n = snprintf(buf, sizeof buf, "key%lu", (unsigned long)i);
+    void **slot = osomapgetlen(m, buf, (size_t)n);
+    CHECK(i % 2 ? slot && *slot == (void *)(seen + i) : !slot);
+  }
+  while (osomapnext(m, &iter, &k, &v)) {
+    CHECK(v >= (void *)seen && v < (void *)(seen + N));
+    CHECK(!seen[(char *)v - seen]);
+    seen[(char *)v - seen] = 1;
+    count++;
+  }
+  CHECK(count == N / 2);
+  /* A reserve that fails leaves the map alone. */
+  CHECK(!osomapreserve(&m, (size_t)-1 / 2));
+  test_allocs_left = 0;
+  CHECK(!osomapreserve(&m, 100000));
+  test_allocs_left = -1;
+  CHECK(m && osomaplen(m) == N / 2 && osomapgetlen(m, "key1", 4));
+  CHECK(osomapreserve(&m, 100000) && osomapreserve(&m, 10));
+  CHECK(m && osomaplen(m) == N / 2 && osomapgetlen(m, "key1", 4));
+  osomapfree(m);
+  m = NULL;
+  test_allocs_left = 1;
+  CHECK(!osomapreserve(&m, 10) && !m);
+  test_allocs_left = -1;
+  CHECK(osomapreserve(&m, 10) && m && osomaplen(m) == 0);
+  osomapset(&m, NULL);
+  CHECK(osomapgetlen(m, "", 0) && osomapget(m, NULL));
+  osomapfree(m);
+}
+
+static void
+test_vec(void) {
+  oso_vec *v = NULL;
+  oso *s = NULL;
+  size_t len, i;
+  char buf[16];
+  CHECK(osoveccount(v) == 0);
+  osovecpush(&v, "alice");
+  osovecpushlen(&v, "b\0b", 3);
+  osoput(&s, "carol");
+  osovecpushoso(&v, s);
+  osovecpushoso(&v, NULL);
+  CHECK(osoveccount(v) == 4);
+  CHECK(!strcmp(osovecat(v, 0, &len), "alice") && len == 5);
+  CHECK(!memcmp(osovecat(v, 1, &len), "b\0b", 4) && len == 3);
+  CHECK(osovecget(&s, v, 1) && osolen(s) == 3 && !memcmp(s, "b\0b", 3));
+  CHECK(!strcmp(osovecat(v, 3, &len), "") && len == 0);
+  osovecpop(v);
+  osovecpop(v);
+  CHECK(osoveccount(v) == 2);
+  osovecpush(&v, "dave");
+  CHECK(!strcmp(osovecat(v, 2, NULL), "dave"));
+  osovecclear(v);
+  CHECK(osoveccount(v) == 0);
+  osovecreserve(&v, 1000, 10000);
+  for (i = 0; i < 1000; i++) {
+    int n = snprintf(buf, sizeof buf, "%lu", (unsigned long)i);
+    osovecpushlen(&v, buf, (size_t)n);
+  }
+  for (i = 0; i < 1000; i++) {
+    snprintf(buf, sizeof buf, "%lu", (unsigned long)i);
+    CHECK(!strcmp(osovecat(v, i, NULL), buf));
+  }
+  osovecfree(v);
+  osovecfree(NULL);
+  osofree(s);
+}
+
+static void
+ref_escape(oso **p, char const *src, size_t len, int kind) {
+  static char const hex[] = "0123456789ABCDEF";
+  size_t i;
+  for (i = 0; i < len; i++) {
+    unsigned char c = (unsigned char)src[i];
+    char tmp[8];
+    int n = 0;
+    if (kind == 'j' && (c < 0x20 || c == '"' || c == '\\')) {
+      char const *short_esc = c == '"' ? "\\\"" : c == '\\' ? "\\\\"
+                            : c == '\b' ? "\\b" : c == '\f' ? "\\f"
+                            : c == '\n' ? "\\n" : c == '\r' ? "\\r"
+                            : c == '\t' ? "\\t" : NULL;
+      if (short_esc) n = snprintf(tmp, sizeof tmp, "%s", short_esc);
+      else n = snprintf(tmp, sizeof tmp, "\\u00%c%c", hex[c >> 4], hex[c & 15]);
+    } else if (kind == 'h' && strchr("&<>\"'", c) && c) {
+      n = snprintf(tmp, sizeof tmp, "%s",
+                   c == '&' ? "&amp;" : c == '<' ? "&lt;" : c == '>' ? "&gt;"
+                   : c == '"' ? "&quot;" : "&#39;");
+    } else if (kind == 'u' && !((c >= 'a' && c <= 'z') ||
+                                (c >= 'A' && c <= 'Z') ||
+                                (c >= '0' && c <= '9') ||
+                                (c && strchr("-._~", c)))) {
+      n = snprintf(tmp, sizeof tmp, "%%%c%c", hex[c >> 4], hex[c & 15]);
+    } else if (kind == 'c' &&
+               (c < 0x20 || c == 0x7F || c == '"' || c == '\\')) {
+      char const *short_esc = c == '"' ? "\\\"" : c == '\\' ? "\\\\"
+                            : c == '\a' ? "\\a" : c == '\b' ? "\\b"
+                            : c == '\f' ? "\\f" : c == '\n' ? "\\n"
+                            : c == '\r' ? "\\r" : c == '\t' ? "\\t"
+                            : c == '\v' ? "\\v" : NULL;
+      if (short_esc) n = snprintf(tmp, sizeof tmp, "%s", short_esc);
+      else n = snprintf(tmp, sizeof tmp, "\\%03o", c);
+    } else {
+      tmp[0] = (char)c;
+      n = 1;
+    }
+    osocatlen(p, tmp, (size_t)n);
+  }
+}
+
+static void
+test_escape(void) {
+  char buf[3000];
+  size_t i;
+  oso *s = NULL, *ref = NULL, *back = NULL;
+  for (i = 0; i < 4000; i++) {
+    size_t len = rndlen();
+    int kind = "jhuc"[i % 4];
+    rndbytes(buf, len, i % 8 < 4 ? NULL : "abcdefgh \"\\<&'\n\x01\x7F");
+    osoput(&s, "pre");
+    osoput(&ref, "pre");
+    ref_escape(&ref, buf, len, kind);
+    switch (kind) {
+    case 'j': CHECK(osocatjsonesc(&s, buf, len)); break;
+    case 'h': CHECK(osocathtmlesc(&s, buf, len)); break;
+    case 'u': CHECK(osocaturlenc(&s, buf, len)); break;
+    default: CHECK(osocatcesc(&s, buf, len)); break;
+    }
+    CHECK(osoeq(s, ref));
+    if (kind == 'u') {
+      osoput(&back, "pre");
+      CHECK(osocaturldec(&back, (char *)s + 3, osolen(s) - 3));
+      CHECK(osolen(back) == len + 3 && !memcmp((char *)back + 3, buf, len));
+    }
+  }
+  osoput(&s, "keep");
+  CHECK(!osocaturldec(&s, "ab%4", 4));
+  CHECKSTR(s, "keep");
+  CHECK(!osocaturldec(&s, "ab%zz", 5));
+  CHECKSTR(s, "keep");
+  CHECK(osocaturldec(&s, "+%41%62", 7));
+  CHECKSTR(s, "keep+Ab");
+  osofree(s);
+  osofree(ref);
+  osofree(back);
+}
+
+static void
+ref_base64(oso **p, unsigned char const *src, size_t len) {
+  static char const digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  size_t i;
+  for (i = 0; i < len; i += 3) {
+    unsigned long v = (unsigned long)src[i] << 16;
+    char out[4];
+    if (i + 1 < len) v |= (unsigned long)src[i + 1] << 8;
+    if (i + 2 < len) v |= src[i + 2];
+    out[0] = digits[v >> 18];
+    out[1] = digits[(v >> 12) & 63];
+    out[2] = i + 1 < len ? digits[(v >> 6) & 63] : '=';
+    out[3] = i + 2 < len ? digits[v & 63] : '=';
+    osocatlen(p, out, 4);
+  }
+}
+
+static void
+test_base64hex(void) {
+  char buf[3000];
+  size_t i, k;
+  oso *enc = NULL, *ref = NULL, *dec = NULL;
+  for (i = 0; i < 4000; i++) {
+    size_t len = rndlen();
+    rndbytes(buf, len, NULL);
+    osoput(&enc, "pre");
+    osoput(&ref, "pre");
+    CHECK(osocatbase64(&enc, buf, len));
+    ref_base64(&ref, (unsigned char const *)buf, len);
+    CHECK(osoeq(enc, ref));
+    osoput(&dec, "pre");
+    CHECK(osocatbase64dec(&dec, (char *)enc + 3, osolen(enc) - 3));
+    CHECK(osolen(dec) == len + 3 && !memcmp((char *)dec + 3, buf, len));
+    /* Padding is optional. */
+    k = osolen(enc);
+    while (k > 3 && ((char *)enc)[k - 1] == '=') k--;
+    osoput(&dec, "pre");
+    CHECK(osocatbase64dec(&dec, (char *)enc + 3, k - 3));
+    CHECK(osolen(dec) == len + 3 && !memcmp((char *)dec + 3, buf, len));
+    /* A bad character anywhere fails and leaves the destination alone. */
+    if (k > 3) {
+      ((char *)enc)[3 + rnd(k - 3)] = "!*-_ \n"[rnd(6)];
+      osoput(&dec, "pre");
+      CHECK(!osocatbase64dec(&dec, (char *)enc + 3, k - 3));
+      CHECKSTR(dec, "pre");
+    }
+    osoput(&enc, "pre");
+    osoput(&ref, "pre");
+    CHECK(osocathex(&enc, buf, len));
+    for (k = 0; k < len; k++)
+      osocatprintf(&ref, "%02x", (unsigned)(unsigned char)buf[k]);
+    CHECK(osoeq(enc, ref));
+    osotoupper(enc);
+    osoput(&dec, "pre");
+    CHECK(osocathexdec(&dec, (char *)enc + 3, osolen(enc) - 3));
+    CHECK(osolen(dec) == len + 3 && !memcmp((char *)dec + 3, buf, len));
+    if (len) {
+      ((char *)enc)[3 + rnd(2 * len)] = "gG/:@`"[rnd(6)];
+      osoput(&dec, "pre");
+      CHECK(!osocathexdec(&dec, (char *)enc + 3, osolen(enc) - 3));
+      CHECKSTR(dec, "pre");
+    }
+  }
+  CHECK(!osocatbase64dec(&dec, "QUJDR", 5));
+  CHECK(!osocathexdec(&dec, "abc", 3));
+  CHECKSTR(dec, "pre");
+  osofree(enc);
+  osofree(ref);
+  osofree(dec);
+}
+
+static void
+test_numbers(void) {
+  char buf[80];
+  size_t i;
+  oso *s = NULL;
+  oso_i64 n;
+  oso_u64 u;
+  size_t end;
+  double d;
+  CHECK(osotoi64("-42,17", 6, &n, &end) && n == -42 && end == 3);
+  CHECK(!osotoi64("x", 1, &n, &end) && n == 0 && end == 0);
+  CHECK(!osotoi64("-", 1, &n, &end) && end == 0);
+  CHECK(!osotoi64("9223372036854775808", 19, &n, &end) && end == 19);
+  CHECK(n == (oso_i64)(((oso_u64)1 << 63) - 1));
+  CHECK(osotoi64("-9223372036854775808", 20, &n, NULL));
+  CHECK(n == -(oso_i64)(((oso_u64)1 << 63) - 1) - 1);
+  CHECK(osotou64("18446744073709551615", 20, &u, NULL) && u == (oso_u64)-1);
+  CHECK(!osotou64("18446744073709551616", 20, &u, NULL) && u == (oso_u64)-1);
+  CHECK(!osotou64("-1", 2, &u, &end) && end == 0);
+  for (i = 0; i < 20000; i++) {
+    size_t len = 0, k, digits = rnd(26);
+    char *ref_end;
+    if (rnd(2)) buf[len++] = "+-"[rnd(2)];
+    for (k = 0; k < digits; k++) buf[len++] = (char)('0' + rnd(10));
+    if (rnd(4) == 0) buf[len++] = 'x';
+    buf[len] = '\0';
+    errno = 0;
+    {
+      long long ref = strtoll(buf, &ref_end, 10);
+      int ok = osotoi64(buf, len, &n, &end);
+      int ref_ok = ref_end != buf && errno != ERANGE;
+      CHECK(ok == ref_ok);
+      if (ref_end != buf) CHECK(n == ref && end == (size_t)(ref_end - buf));
+      else CHECK(end == 0);
+    }
+  }
+  for (i = 0; i < 20000; i++) {
+    size_t len = 0, k, ndig = rnd(25), nfrac = rnd(25);
+    char *ref_end;
+    double ref;
+    int ok;
+    if (rnd(2)) buf[len++] = "+-"[rnd(2)];
+    for (k = 0; k < ndig; k++) buf[len++] = (char)('0' + rnd(10));
+    if (rnd(3)) {
+      buf[len++] = '.';
+      for (k = 0; k < nfrac; k++) buf[len++] = (char)('0' + rnd(10));
+    }
+    if (rnd(2)) {
+      buf[len++] = "eE"[rnd(2)];
+      if (rnd(2)) buf[len++] = "+-"[rnd(2)];
+      len += (size_t)sprintf(buf + len, "%d", (int)rnd(i % 10 ? 40 : 400));
+      if (rnd(8) == 0) len--;
+    }
+    buf[len] = '\0';
+    ref = strtod(buf, &ref_end);
+    ok = osotodouble(buf, len, &d, &end);
+    CHECK(end == (size_t)(ref_end - buf));
+    CHECK(ok == (ref_end != buf && ref != HUGE_VAL && ref != -HUGE_VAL));
+    CHECK(!memcmp(&d, &ref, sizeof d));
+  }
+  /* 2^53 + 1 is halfway between two doubles, so only a nonzero digit at the
+     very end can round it up, even past the digits the slow path keeps. */
+  {
+    static char big[5000];
+    CHECK(osotodouble("9007199254740993", 16, &d, NULL));
+    CHECK(d == 9007199254740992.0);
+    memset(big, '0', sizeof big);
+    memcpy(big, "9007199254740993.", 17);
+    big[sizeof big - 1] = '1';
+    CHECK(osotodouble(big, sizeof big, &d, &end) && end == sizeof big);
+    CHECK(d == 9007199254740994.0);
+    big[sizeof big - 1] = '0';
+    CHECK(osotodouble(big, sizeof big, &d, NULL) && d == 9007199254740992.0);
+    memset(big, '0', sizeof big);
+    big[0] = '.';
+    memcpy(big + sizeof big - 8, "123e4997", 8);
+    CHECK(osotodouble(big, sizeof big, &d, &end) && end == sizeof big);
+    CHECK(d == 123000.0);
+    memset(big, '9', sizeof big);
+    CHECK(!osotodouble(big, sizeof big, &d, NULL) && d == HUGE_VAL);
+  }
+  /* Shortest round trip: the output reads back as the same double. */
+  for (i = 0; i < 100000; i++) {
+    oso_u64 bits = (oso_u64)rnd((size_t)-1) << 32 ^ (oso_u64)rnd((size_t)-1);
+    double back;
+    if (i < 1000) bits &= (((oso_u64)1 << 52) - 1) | (oso_u64)1 << 63;
+    memcpy(&d, &bits, sizeof d);
+    if (d != d || d - d != 0) continue;
+    osoclear(&s);
+    CHECK(osocatdouble(&s, d));
+    CHECK(osotodouble((char *)s, osolen(s), &back, &end));
+    CHECK(end == osolen(s) && !memcmp(&d, &back, sizeof d));
+    CHECK(osolen(s) <= (size_t)snprintf(buf, sizeof buf, "%.17g", d) + 4);
+  }
+  osoclear(&s);
+  osocatdouble(&s, 0.1);
+  osocat(&s, " ");
+  osocatdouble(&s, 1e20);
+  osocat(&s, " ");
+  osocatdouble(&s, 1e21);
+  osocat(&s, " ");
+  osocatdouble(&s, 1.5e-7);
+  osocat(&s, " ");
+  osocatdouble(&s, -0.0);
+  osocat(&s, " ");
+  osocatdouble(&s, 5e-324);
+  osocat(&s, " ");
+  osocatdouble(&s, HUGE_VAL);
+  osocat(&s, " ");
+  osocatdouble(&s, (double)NAN);
+  CHECKSTR(s, "0.1 100000000000000000000 1e+21 1.5e-7 -0 5e-324 inf nan");
+  osofree(s);
+}
+
+static int
+test_fmtpair(oso **p, va_list *ap) {
+  int a = va_arg(*ap, int), b = va_arg(*ap, int);
+  return osocatprintf(p, "<%d,%d>", a, b);
+}
+
+static oso *volatile test_none;
+
+/* `%S` has to give the same output as `%s` for every flag, width and
+   precision, whether or not the format is walked for `%{}`. */
+static void
+test_printfS(void) {
+  static char const *const flags[] = {"", "-", "0", "-0", " ", "#"};
+  static char const *const widths[] = {"", "0", "3", "12", "*"};
+  static char const *const precs[] = {"", ".", ".0", ".2", ".12", ".*"};
+  static int const stars[] = {0, 4, 20, -1, -7};
+  size_t const nstars = sizeof stars / sizeof *stars;
+  char const *text = "hello";
+  oso *arg = NULL, *with_s = NULL, *with_S = NULL;
+  size_t f, w, p, k, walk;
+  osoput(&arg, text);
+  for (walk = 0; walk < 2; walk++)
+    for (f = 0; f < sizeof flags / sizeof *flags; f++)
+      for (w = 0; w < sizeof widths / sizeof *widths; w++)
+        for (p = 0; p < sizeof precs / sizeof *precs; p++)
+          for (k = 0; k < nstars; k++) {
+            char spec[40], fmt_s[50], fmt_S[50];
+            int a = stars[k], b = stars[(k + 1) % nstars];
+            int star_w = widths[w][0] == '*';
+            int star_p = precs[p][0] && precs[p][1] == '*';
+            sprintf(spec, "%%%s%s%s", flags[f], widths[w], precs[p]);
+            sprintf(fmt_s, "%s[%ss]", walk ? "%{pair}" : "", spec);
+            sprintf(fmt_S, "%s[%sS]", walk ? "%{pair}" : "", spec);
+            osoclear(&with_s);
+            osoclear(&with_S);
+            if (walk) osocat(&with_s, "<1,2>");
+            /* The reference is always %s straight through stb_sprintf. */
+            if (star_w && star_p) {
+              osocatprintf(&with_s, fmt_s + 7 * walk, a, b, text);
+              if (walk) osocatprintf(&with_S, fmt_S, 1, 2, a, b, arg);
+              else osocatprintf(&with_S, fmt_S, a, b, arg);
+            } else if (star_w || star_p) {
+              osocatprintf(&with_s, fmt_s + 7 * walk, a, text);
+              if (walk) osocatprintf(&with_S, fmt_S, 1, 2, a, arg);
+              else osocatprintf(&with_S, fmt_S, a, arg);
+            } else {
+              osocatprintf(&with_s, fmt_s + 7 * walk, text);
+              if (walk) osocatprintf(&with_S, fmt_S, 1, 2, arg);
+              else osocatprintf(&with_S, fmt_S, arg);
+            }
+            if (!osoeq(with_s, with_S)) {
+              fprintf(stderr, "%s:%d: %s gave '%s', %s gave '%s'\n",
+                      __FILE__, __LINE__, fmt_s + 7 * walk, (char *)with_s,
+                      fmt_S, (char *)with_S);
+              test_failures++;
+            }
+          }
+  osofree(arg);
+  osofree(with_s);
+  osofree(with_S);
+}
+
+static void
+test_printf(void) {
+  oso *s = NULL, *arg = NULL;
+  char const *fmt;
+  size_t walk;
+  CHECK(osoformatregister("pair", test_fmtpair));
+  CHECK(!osoformatregister("", test_fmtpair));
+  CHECK(!osoformatregister("a}b", test_fmtpair));
+  /* Through a variable, since the compiler doesn't know about %{} and %S. */
+  fmt = "%d %{pair} %s %{nope} %5.2f%%";
+  CHECK(osoputprintf(&s, fmt, 1, 2, 3, "x", 1.5));
+  CHECKSTR(s, "1 <2,3> x %{nope}  1.50%");
+  fmt = "%{pair}%lld|%zu|%c|%-3d|%*d";
+  CHECK(osoputprintf(&s, fmt, 4, 5, 1LL << 40,
+                     (size_t)7, 'q', 8, 3, 9));
+  CHECKSTR(s, "<4,5>1099511627776|7|q|8  |  9");
+  /* Negative * widths and precisions, with and without the walk, against the
+     C library. */
+  {
+    char ref[64];
+    sprintf(ref, "[%*d|%-*d|%0*d|%.*d|%*.*f|%.*s]", -5, 42, -5, 42, -5, 42,
+            -3, 7, -8, -2, 1.5, -1, "abc");
+    fmt = "[%*d|%-*d|%0*d|%.*d|%*.*f|%.*s]";
+    CHECK(osoputprintf(&s, fmt, -5, 42, -5, 42, -5, 42, -3, 7, -8, -2, 1.5,
+                       -1, "abc"));
+    CHECKSTR(s, ref);
+    fmt = "%{pair}[%*d|%-*d|%0*d|%.*d|%*.*f|%.*s]";
+    CHECK(osoputprintf(&s, fmt, 1, 2, -5, 42, -5, 42, -5, 42, -3, 7, -8, -2,
+                       1.5, -1, "abc"));
+    CHECK(osolen(s) == strlen(ref) + 5 && !strcmp((char *)s + 5, ref));
+  }
+  /* Every length modifier reads and writes its own type, with and without
+     the walk. Each %n target has a neighbor that mustn't be touched. */
+  for (walk = 0; walk < 2; walk++) {
+    signed char hh[2] = {-1, -1};
+    short h[2] = {-1, -1};
+    long l[2] = {-1, -1};
+    size_t z[2] = {0, 0};
+    intmax_t j[2] = {-1, -1};
+    int n[2] = {-1, -1};
+    char const *text = "2.500000|-1099511627776|18446744073709551615|";
+    size_t const at = strlen(text) + 5 * walk;
+    fmt = "%{pair}%Lf|%jd|%ju|%hhn%hn%ln%zn%jn%n" + 7 * !walk;
+    if (walk)
+      CHECK(osoputprintf(&s, fmt, 1, 2, (long double)2.5,
+                         -((intmax_t)1 << 40), ~(uintmax_t)0, hh, h, l, z, j,
+                         n));
+    else
+      CHECK(osoputprintf(&s, fmt, (long double)2.5, -((intmax_t)1 << 40),
+                         ~(uintmax_t)0, hh, h, l, z, j, n));
+    CHECK(osolen(s) == at && !strcmp((char *)s + 5 * walk, text));
+    CHECK(hh[0] == (signed char)at && hh[1] == -1);
+    CHECK(h[0] == (short)at && h[1] == -1);
+    CHECK(l[0] == (long)at && l[1] == -1);
+    CHECK(z[0] == at && z[1] == 0);
+    CHECK(j[0] == (intmax_t)at && j[1] == -1);
+    CHECK(n[0] == (int)at && n[1] == -1);
+  }
+  osoputlen(&arg, "a\0b", 3);
+  fmt = "[%S|%5S|%-5S|%.1S]";
+  CHECK(osoputprintf(&s, fmt, arg, arg, arg, arg));
+  CHECK(osolen(s) == 19 && !memcmp(s, "[a\0b|  a\0b|a\0b  |a]", 20));
+  CHECK(osoputprintf(&s, fmt, test_none, test_none, test_none, test_none));
+  CHECKSTR(s, "[|     |     |]");
+  test_printfS();
+  osofree(s);
+  osofree(arg);
+}
+
+static void
+test_bounded(void) {
+  size_t storage[8];
+  oso *s = osoinitbuf(storage, sizeof storage), *t;
+  size_t cap = osocap(s);
+  char big[200];
+  char const *fmt;
+  CHECK(s && cap > 0 && cap < sizeof storage);
+  CHECK(osoinitbuf(storage, 4) == NULL);
+  memset(big, 'z', sizeof big);
+  CHECK(osocatlenbounded(s, big, 3) == 0 && osolen(s) == 3);
+  CHECK(osocatlenbounded(s, big, sizeof big) == sizeof big - (cap - 3));
+  CHECK(osolen(s) == cap && osocap(s) == cap);
+  CHECK(osocatbounded(s, "more") == 4);
+  osoclear(&s);
+  CHECK(osocatprintfbounded(s, "%d", 12345) == 0);
+  CHECKSTR(s, "12345");
+  CHECK(osocatprintfbounded(s, "%0*d", (int)cap, 7) == 5);
+  CHECK(osolen(s) == cap);
+  osoclear(&s);
+  t = NULL;
+  osoput(&t, "abc");
+  fmt = "%S|%-4S|";
+  CHECK(osocatprintfbounded(s, fmt, t, t) == 0);
+  CHECKSTR(s, "abc|abc |");
+  osofree(t);
+  CHECK(osocatbounded(NULL, "abc") == 3);
+  /* Caller storage, until it spills onto the heap. */
+  osoclear(&s);
+  t = s;
+  CHECK(osoputprintf(&s, "%d", 42) && s == t);
+  CHECK(osocatlen(&s, big, sizeof big) && s != t);
+  CHECK(osolen(s) == sizeof big + 2 && !memcmp(s, "42zz", 4));
+  osofree(s);
+}
+
+static void
+test_fill(void) {
+  oso *s = NULL;
+  size_t i;
+  CHECK(osofill(&s, '-', 3));
+  CHECK(osofill(&s, '>', 1) && osofill(&s, '!', 0));
+  CHECKSTR(s, "--->");
+  CHECK(osofill(&s, 'q', 70000) && osolen(s) == 70004);
+  for (i = 4; i < 70004 && ((char *)s)[i] == 'q'; i++) {}
+  CHECK(i == 70004 && ((char *)s)[70004] == '\0');
+  osoclear(&s);
+  CHECK(osocatchar(&s, '>'));
+  CHECK(osocatchars(&s, '=', 2) && osocatchars(&s, '!', 0));
+  CHECKSTR(s, ">==");
+  osoclear(&s);
+  for (i = 0; i < 5000; i++) CHECK(osocatchar(&s, (char)('a' + i % 26)));
+  for (i = 0; i < 5000; i++) CHECK(((char *)s)[i] == (char)('a' + i % 26));
+  CHECK(osolen(s) == 5000 && ((char *)s)[5000] == '\0');
+  CHECK(osocatchars(&s, 'q', 70000) && osolen(s) == 75000);
+  CHECK(((char *)s)[74999] == 'q' && ((char *)s)[75000] == '\0');
+  /* Growth at least doubles, so a million appends to an empty string only
+     reallocate a couple dozen times. */
+  osofree(s);
+  s = NULL;
+  test_allocs_left = 64;
+  for (i = 0; i < 1000000 && osocatchar(&s, 'g'); i++) {}
+  test_allocs_left = -1;
+  CHECK(i == 1000000 && osolen(s) == 1000000);
+  osofree(s);
+}
+
+static void
+test_concat(void) {
+  oso *shards[5] = {NULL, NULL, NULL, NULL, NULL}, *out = NULL;
+  oso *ref = NULL;
+  size_t i, j, k, base, begin, end, total = 0;
+  for (i = 0; i < 5; i++) {
+    if (i == 2) continue;
+    for (j = 0; j <= 1000 * i; j++) {
+      char c = (char)('A' + i);
+      osocatlen(&shards[i], &c, 1);
+    }
+  }
+  osoput(&out, "head");
+  osoput(&ref, "head");
+  for (i = 0; i < 5; i++) osocatoso(&ref, shards[i]);
+  CHECK(osoconcat(&out, (oso const *const *)shards, 5));
+  CHECK(osoeq(out, ref));
+  for (k = 1; k < 9; k++) {
+    osoput(&out, "head");
+    CHECK(osoconcatprep(&out, (oso const *const *)shards, 5, &base));
+    CHECK(base == 4 && osolen(out) == osolen(ref));
+    for (i = 0; i < k; i++)
+      osoconcatpart(out, base, (oso const *const *)shards, 5, k - 1 - i, k);
+    CHECK(osoeq(out, ref));
+  }
+  for (k = 1; k < 9; k++) {
+    size_t next = 0;
+    for (i = 0; i < k; i++) {
+      osopartrange(37, k, i, &begin, &end);
+      CHECK(begin == next && end >= begin && end - begin <= 37 / k + 1);
+      next = end;
+      total += end - begin;
+    }
+    CHECK(next == 37);
+  }
+  CHECK(total == 37 * 8);
+  osopartrange(37, 0, 0, &begin, &end);
+  CHECK(begin == end);
+  osopartrange(37, 4, 4, &begin, &end);
+  CHECK(begin == end);
+  osoput(&out, "head");
+  CHECK(osoconcatprep(&out, (oso const *const *)shards, 5, &base));
+  memset((char *)out + base, '.', osolen(out) - base);
+  osoconcatpart(out, base, (oso const *const *)shards, 5, 0, 0);
+  osoconcatpart(out, base, (oso const *const *)shards, 5, 3, 3);
+  for (i = base; i < osolen(out); i++) CHECK(((char *)out)[i] == '.');
+  for (i = 0; i < 5; i++) osofree(shards[i]);
+  osofree(out);
+  osofree(ref);
+}
+
+static void
+test_huge(void) {
+  /* Big enough for the streaming fill, and for the mapped strings in the
+     configurations that turn them on. */
+  size_t const n = (size_t)3 << 20;
+  char *buf = malloc(n);
+  oso *s = NULL;
+  size_t i, k;
+  if (!buf) return;
+  for (i = 0; i < n; i++) buf[i] = (char)(i * 7);
+  for (i = 0; i < 8; i++) CHECK(osocatlen(&s, buf, n / 8));
+  CHECK(osolen(s) == n && !memcmp(s, buf, n));
+  CHECK(osoputlen(&s, buf + 1, n - 1));
+  CHECK(osolen(s) == n - 1 && !memcmp(s, buf + 1, n - 1));
+  CHECK(osofill(&s, 'x', n) && ((char *)s)[2 * n - 2] == 'x');
+  CHECK(osoinsert(&s, 5, "hi", 2) && !memcmp((char *)s + 5, "hi", 2));
+  CHECK(osolen(s) == 2 * n + 1 && ((char *)s)[2 * n + 1] == '\0');
+  /* Odd sizes and offsets, for the parts of a copy split across threads. */
+  for (i = 0; i < 20; i++) {
+    size_t len = 100000 + rnd(400000), off = rnd(64);
+    CHECK(osoputlen(&s, buf + off, len));
+    CHECK(osolen(s) == len && !memcmp(s, buf + off, len));
+    CHECK(((char *)s)[len] == '\0');
+    CHECK(osofill(&s, (char)i, len) && osolen(s) == 2 * len);
+    CHECK(!memcmp(s, buf + off, len) && ((char *)s)[2 * len] == '\0');
+    for (k = len; k < 2 * len && ((char *)s)[k] == (char)i; k++) {}
+    CHECK(k == 2 * len);
+  }
+  osoclear(&s);
+  CHECK(osocatchars(&s, 'y', 100000) && osolen(s) == 100000);
+  /* Lots of small shards, split across threads by bytes. */
+  {
+    oso *shards[300], *ref = NULL;
+    for (i = 0; i < 300; i++) {
+      shards[i] = NULL;
+      osocatlen(&shards[i], buf + i, rnd(3000));
+      osocatoso(&ref, shards[i]);
+    }
+    osoput(&s, "x");
+    CHECK(osoconcat(&s, (oso const *const *)shards, 300));
+    CHECK(osolen(s) == osolen(ref) + 1);
+    CHECK(!memcmp((char *)s + 1, ref, osolen(ref)));
+    for (i = 0; i < 300; i++) osofree(shards[i]);
+    osofree(ref);
+  }
+  osofree(s);
+  free(buf);
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+static void
+test_readback(int fd, oso **out) {
+  char buf[4096];
+  ssize_t n;
+  osoclear(out);
+  lseek(fd, 0, SEEK_SET);
+  while ((n = read(fd, buf, sizeof buf)) > 0) osocatlen(out, buf, (size_t)n);
+}
+
+static void
+test_writer(void) {
+  FILE *f = tmpfile();
+  oso_writer w;
+  oso *expect = NULL, *got = NULL, *arg = NULL;
+  char big[10000];
+  size_t i;
+  int fd;
+  if (!f) return;
+  fd = fileno(f);
+  osowriterinit(&w, fd, 256);
+  memset(big, 'B', sizeof big);
+  for (i = 0; i < 2000; i++) {
+    switch (rnd(4)) {
+    case 0:
+      osowrite(&w, "line\n");
+      osocat(&expect, "line\n");
+      break;
+    case 1:
+      osowriteprintf(&w, "%lu %s\n", (unsigned long)i, "printf");
+      osocatprintf(&expect, "%lu %s\n", (unsigned long)i, "printf");
+      break;
+    case 2:
+      osoput(&arg, "oso");
+      osowriteoso(&w, arg);
+      osocatoso(&expect, arg);
+      break;
+    default: {
+      size_t len = rnd(sizeof big);
+      osowritelen(&w, big, len);
+      osocatlen(&expect, big, len);
+      break;
+    }
+    }
+  }
+  CHECK(osowriterflush(&w) == 0 && w.err == 0);
+  test_readback(fd, &got);
+  CHECK(osoeq(got, expect));
+  osowriterfree(&w);
+  {
+    oso *strs[3] = {NULL, NULL, NULL};
+    CHECK(ftruncate(fd, 0) == 0);
+    lseek(fd, 0, SEEK_SET);
+    osoput(&strs[0], "a");
+    osoput(&strs[2], "c");
+    CHECK(osowritefd(fd, (oso const *const *)strs, 3) == 0);
+    test_readback(fd, &got);
+    CHECKSTR(got, "ac");
+    osofree(strs[0]);
+    osofree(strs[2]);
+  }
+  /* Running out of memory loses the buffer, or with
+     OSO_KEEP_ON_ALLOC_FAILURE, only the write that failed. */
+  CHECK(ftruncate(fd, 0) == 0);
+  lseek(fd, 0, SEEK_SET);
+  osowriterinit(&w, fd, 1 << 20);
+  CHECK(osowrite(&w, "kept") == 0);
+  test_allocs_left = 0;
+  CHECK(osowritelen(&w, big, sizeof big) == ENOMEM);
+  test_allocs_left = -1;
+#if defined(OSO_KEEP_ON_ALLOC_FAILURE)
+  CHECK(w.err == 0 && osowriterflush(&w) == 0);
+  test_readback(fd, &got);
+  CHECKSTR(got, "kept");
+#else
+  CHECK(w.err == ENOMEM && osowrite(&w, "x") == ENOMEM);
+#endif
+  osowriterfree(&w);
+  fclose(f);
+  osofree(expect);
+  osofree(got);
+  osofree(arg);
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+static void
+test_logq(void) {
+  FILE *f = tmpfile();
+  oso_logq q;
+  oso *mine = NULL, *expect = NULL, *got = NULL;
+  size_t i;
+  if (!f) return;
+  osologqinit(&q);
+  for (i = 0; i < 1000; i++) {
+    osologprintf(&q, &mine, 128, "message %lu\n", (unsigned long)i);
+    osocatprintf(&expect, "message %lu\n", (unsigned long)i);
+    if (i == 500) CHECK(osologqdrain(&q, fileno(f)) == 0);
+  }
+  osologqpush(&q, &mine);
+  CHECK(mine == NULL);
+  CHECK(osologqdrain(&q, fileno(f)) == 0);
+  CHECK(osologqdrain(&q, fileno(f)) == 0);
+  test_readback(fileno(f), &got);
+  CHECK(osoeq(got, expect));
+  osologprintf(&q, &mine, 1, "dropped");
+  osologqfree(&q);
+
+  /* The thread's own buffer, switching between two queues. */
+  {
+    oso_logq other;
+    osologqinit(&other);
+    osoclear(&expect);
+    for (i = 0; i < 20000; i++) {
+      osolog(&q, "line %lu\n", (unsigned long)i);
+      osocatprintf(&expect, "line %lu\n", (unsigned long)i);
+    }
+    osolog(&other, "other\n");
+    CHECK(osologflush());
+    CHECK(osologflush());
+    CHECK(ftruncate(fileno(f), 0) == 0);
+    lseek(fileno(f), 0, SEEK_SET);
+    CHECK(osologqdrain(&q, fileno(f)) == 0);
+    test_readback(fileno(f), &got);
+    CHECK(osoeq(got, expect));
+    CHECK(ftruncate(fileno(f), 0) == 0);
+    lseek(fileno(f), 0, SEEK_SET);
+    CHECK(osologqdrain(&other, fileno(f)) == 0);
+    test_readback(fileno(f), &got);
+    CHECKSTR(got, "other\n");
+  }
+  fclose(f);
+  osofree(expect);
+  osofree(got);
+}
+
+#if defined(OSO_THREADS)
+enum { TEST_LOG_THREADS = 4, TEST_LOG_LINES = 20000 };
+
+static void *
+test_logproducer(void *arg) {
+  oso_logq *q = (oso_logq *)arg;
+  size_t i;
+  static int next_id;
+  int id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+  for (i = 0; i < TEST_LOG_LINES; i++)
+    osolog(q, "t%d %lu\n", id, (unsigned long)i);
+  CHECK(osologflush());
+  return NULL;
+}
+
+static void
+test_logwriter(void) {
+  FILE *f = tmpfile();
+  oso_logq q;
+  oso *got = NULL;
+  pthread_t threads[TEST_LOG_THREADS];
+  unsigned long next[TEST_LOG_THREADS] = {0};
+  char const *line;
+  size_t i, lines = 0;
+  if (!f) return;
+  osologqinit(&q);
+  CHECK(osologqstop(&q) == 0);
+  CHECK(osologqstart(&q, fileno(f)) == 0);
+  CHECK(osologqstart(&q, fileno(f)) == EBUSY);
+  for (i = 0; i < TEST_LOG_THREADS; i++)
+    CHECK(pthread_create(&threads[i], NULL, test_logproducer, &q) == 0);
+  for (i = 0; i < TEST_LOG_THREADS; i++) pthread_join(threads[i], NULL);
+  CHECK(osologqstop(&q) == 0);
+  CHECK(q.writer == NULL && q.head == NULL);
+  /* Lines from different threads interleave, but each thread's lines have to
+     come out in order. */
+  test_readback(fileno(f), &got);
+  for (line = (char *)got; got && *line; line = strchr(line, '\n') + 1) {
+    int id;
+    unsigned long n;
+    if (sscanf(line, "t%d %lu", &id, &n) != 2 || id < 0 ||
+        id >= TEST_LOG_THREADS || n != next[id]++) {
+      CHECK(!"log line out of order");
+      break;
+    }
+    lines++;
+  }
+  CHECK(lines == TEST_LOG_THREADS * TEST_LOG_LINES);
+  fclose(f);
+  osofree(got);
+}
+#endif
+#endif
+#endif
+
+static void
+test_scratch(void) {
+  oso *a, *b;
+  ososcratchfree();
+  a = ososcratchget(); /* a miss, so a new one */
+  CHECK(a && osolen(a) == 0 && osocap(a) >= 256);
+  osoputprintf(&a, "%0500d", 1);
+  ososcratchput(a);
+  b = ososcratchget();
+  CHECK(b && osolen(b) == 0 && osocap(b) >= 500);
+  CHECK(b == a);
+  ososcratchput(b);
+  test_allocs_left = 0;
+  ososcratchfree();
+  CHECK(ososcratchget() == NULL);
+  test_allocs_left = -1;
+  ososcratchput(NULL);
+  ososcratchfree();
+}
+
+/* Runs `fn` with the allocation after the first `ok_allocs` failing, and
+   checks that the alloc failure rule was followed. */
+static void
+test_failone(int (*fn)(oso **p), long ok_allocs, int line) {
+  oso *s = NULL;
+  int ok;
+  osoput(&s, "original");
+  test_allocs_left = ok_allocs;
+  ok = fn(&s);
+  test_allocs_left = -1;
+  if (ok) {
+    fprintf(stderr, "%s:%d: expected an allocation failure\n", __FILE__, line);
+    test_failures++;
+  }
+#if defined(OSO_KEEP_ON_ALLOC_FAILURE)
+  if (osolen(s) != 8 || strcmp((char *)s, "original")) {
+    fprintf(stderr, "%s:%d: string wasn't kept\n", __FILE__, line);
+    test_failures++;
+  }
+  osofree(s);
+#else
+  if (s) {
+    fprintf(stderr, "%s:%d: string wasn't freed\n", __FILE__, line);
+    test_failures++;
+    osofree(s);
+  }
+#endif
+}
+
+static char test_bigbuf[1000];
+
+static int
+test_fail_cat(oso **p) {
+  return osocatlen(p, test_bigbuf, sizeof test_bigbuf);
+}
+static int
+test_fail_put(oso **p) {
+  return osoputlen(p, test_bigbuf, sizeof test_bigbuf);
+}
+static int
+test_fail_putprintf(oso **p) {
+  return osoputprintf(p, "%0999d", 1);
+}
+static int
+test_fail_catprintf(oso **p) {
+  return osocatprintf(p, "%s%0999d", "x", 1);
+}
+static int
+test_fail_custom(oso **p) {
+  char const *fmt = "%{pair}%0999d";
+  return osocatprintf(p, fmt, 1, 2, 3);
+}
+static int
+test_fail_insert(oso **p) {
+  return osoinsert(p, 3, test_bigbuf, sizeof test_bigbuf);
+}
+static int
+test_fail_splice(oso **p) {
+  return ososplice(p, 3, 2, test_bigbuf, sizeof test_bigbuf);
+}
+static int
+test_fail_json(oso **p) {
+  return osocatjsonesc(p, test_bigbuf, sizeof test_bigbuf);
+}
+static int
+test_fail_base64(oso **p) {
+  return osocatbase64(p, test_bigbuf, sizeof test_bigbuf);
+}
+static int
+test_fail_hex(oso **p) {
+  return osocathex(p, test_bigbuf, sizeof test_bigbuf);
+}
+static int
+test_fail_utf8(oso **p) {
+  return osocatutf8len(p, test_bigbuf, sizeof test_bigbuf);
+}
+static int
+test_fail_ensurecap(oso **p) {
+  return osoensurecap(p, 1000);
+}
+static int
+test_fail_double(oso **p) {
+  return osocatdouble(p, 1.0 / 3.0);
+}
+static int
+test_fail_fill(oso **p) {
+  return osofill(p, 'x', 1000);
+}
+static int
+test_fail_char(oso **p) {
+  int ok = 1;
+  while (ok && osoavail(*p)) ok = osocatchar(p, 'x');
+  return ok && osocatchar(p, 'x');
+}
+static int
+test_fail_concat(oso **p) {
+  oso *shard = NULL;
+  int ok;
+  osoputlen(&shard, test_bigbuf, sizeof test_bigbuf);
+  test_allocs_left = 0;
+  ok = osoconcat(p, (oso const *const *)&shard, 1);
+  osofree(shard);
+  return ok;
+}
+
+/* The containers follow the same rule. */
+static void
+test_allocfail_containers(void) {
+  static char text[20000];
+  oso_vec *v = NULL;
+  oso_map *m = NULL;
+  oso_rope *r = NULL, *other = NULL;
+  oso *key = NULL, *before = NULL, *after = NULL;
+  size_t i;
+  long n;
+  int keep = 0, ok;
+#if defined(OSO_KEEP_ON_ALLOC_FAILURE)
+  keep = 1;
+#endif
+  CHECK(osovecpush(&v, "kept"));
+  test_allocs_left = 0;
+  CHECK(!osovecpushlen(&v, test_bigbuf, sizeof test_bigbuf));
+  test_allocs_left = -1;
+  CHECK(keep ? osoveccount(v) == 1 && !strcmp(osovecat(v, 0, NULL), "kept")
+             : v == NULL);
+  osovecfree(v);
+  osoput(&key, "kept");
+  CHECK(osomapset(&m, key) != NULL);
+  for (i = 0;; i++) { /* until the table has to grow */
+    void **slot;
+    key = NULL;
+    osoputprintf(&key, "more%lu", (unsigned long)i);
+    test_allocs_left = 0;
+    slot = osomapset(&m, key);
+    test_allocs_left = -1;
+    if (!slot) break;
+  }
+  CHECK(keep ? m && osomapgetlen(m, "kept", 4) : m == NULL);
+  osomapfree(m);
+  /* Each rope edit, with every one of its allocations failing in turn. */
+  rndbytes(text, sizeof text, "abcdefghij");
+  CHECK(osoropeinsert(&r, 0, text, sizeof text));
+  for (i = 0; i < 3; i++) {
+    for (n = 0;; n++) {
+      CHECK(osoputrope(&before, r));
+      if (i == 2) CHECK(osoropeinsert(&other, 0, "tail", 4));
+      test_allocs_left = n;
+      if (i == 0) ok = osoropeinsert(&r, 5001, "middle", 6);
+      else if (i == 1) ok = osoropeerase(&r, 3001, 9000);
+      else ok = osoropecat(&r, other);
+      test_allocs_left = -1;
+      if (ok) break;
+      if (keep) {
+        CHECK(osoputrope(&after, r) && osoeq(after, before));
+        osoropefree(other);
+      } else {
+        CHECK(r == NULL);
+        CHECK(osoropeinsert(&r, 0, (char *)before, osolen(before)));
+      }
+      other = NULL;
+    }
+    other = NULL;
+  }
+  CHECK(osoputrope(&after, r) && osolen(after) == sizeof text - 9000 + 10);
+  osoropefree(r);
+  osofree(before);
+  osofree(after);
+}
+
+static void
+test_allocfail(void) {
+  oso *s = NULL;
+  memset(test_bigbuf, 'a', sizeof test_bigbuf);
+  test_failone(test_fail_cat, 0, __LINE__);
+  test_failone(test_fail_put, 0, __LINE__);
+  test_failone(test_fail_putprintf, 0, __LINE__);
+  test_failone(test_fail_catprintf, 0, __LINE__);
+  test_failone(test_fail_custom, 0, __LINE__);
+  test_failone(test_fail_insert, 0, __LINE__);
+  test_failone(test_fail_splice, 0, __LINE__);
+  test_failone(test_fail_json, 0, __LINE__);
+  test_failone(test_fail_base64, 0, __LINE__);
+  test_failone(test_fail_hex, 0, __LINE__);
+  test_failone(test_fail_utf8, 0, __LINE__);
+  test_failone(test_fail_ensurecap, 0, __LINE__);
+  test_failone(test_fail_double, 0, __LINE__);
+  test_failone(test_fail_fill, 0, __LINE__);
+  test_failone(test_fail_char, 0, __LINE__);
+  test_failone(test_fail_concat, -1, __LINE__);
+  test_allocfail_containers();
+  /* A result that fits is formatted in place, without allocating. */
+  osoput(&s, "original");
+  test_allocs_left = 0;
+  CHECK(osoputprintf(&s, "%s-%d", "new", 42));
+  test_allocs_left = -1;
+  CHECKSTR(s, "new-42");
+  osofree(s);
+}
+
+int
+main(void) {
+#if defined(__AVX2__) && (defined(__GNUC__) || defined(__clang__))
+  if (!__builtin_cpu_supports("avx2")) {
+    puts("  skipped, this CPU doesn't have AVX2");
+    return 0;
+  }
+#endif
+  test_basics();
+  test_splice();
+  test_utf8();
+  test_case();
+  test_compare();
+  test_sort();
+  test_rope();
+  test_map();
+  test_vec();
+  test_escape();
+  test_base64hex();
+  test_numbers();
+  test_printf();
+  test_bounded();
+  test_fill();
+  test_concat();
+  test_huge();
+#if defined(__unix__) || defined(__APPLE__)
+  test_writer();
+#if defined(__GNUC__) || defined(__clang__)
+  test_logq();
+#if defined(OSO_THREADS)
+  test_logwriter();
+#endif
+#endif
+#endif
+  test_scratch();
+  test_allocfail();
+  if (test_failures) {
+    printf("  %d failed\n", test_failures);
+    return 1;
+  }
+  puts("  ok");
+  return 0;
+}
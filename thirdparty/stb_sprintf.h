@@ -3,7 +3,8 @@
 // http://github.com/nothings/stb
 //
 // allowed types:  sc uidBboXx p AaGgEef n
-// lengths      :  hh h ll j z t I64 I32 I
+//                 (and S, if STB_SPRINTF_LENGTH_OF is defined)
+// lengths      :  hh h ll j z t I64 I32 I L
 //
 // Contributors:
 //    Fabian "ryg" Giesen (reformatting)
@@ -120,6 +121,12 @@ suffix, add "_" specifier: "%_$d" -> "2.53M".
 In addition to octal and hexadecimal conversions, you can print
 integers in binary: "%b" for 256 would print 100.
 
+If you define STB_SPRINTF_LENGTH_OF(ptr) before the implementation, "%S"
+takes a pointer to a string whose length that macro returns, instead of
+scanning for a zero terminator. Width, precision and "-" work like "%s".
+A null pointer prints as an empty string. At most 2^31 - 1 chars of it are
+printed.
+
 PERFORMANCE vs MSVC 2008 32-/64-bit (GCC is even slower than MSVC):
 ===================================================================
 "%d" across all 32-bit ints (4.8x/4.0x faster than 32-/64-bit MSVC)
@@ -275,6 +282,12 @@ STBSP__PUBLICDEF void STB_SPRINTF_DECORATE(set_separators)(char pcomma, char ppe
 #define STBSP__METRIC_NOSPACE 1024
 #define STBSP__METRIC_1024 2048
 #define STBSP__METRIC_JEDEC 4096
+#define STBSP__QUARTERWIDTH 8192
+#define STBSP__LONGDOUBLE 16384
+
+// reads a floating point argument, which is a long double after 'L'
+#define STBSP__FLOATARG() \
+   ((fl & STBSP__LONGDOUBLE) ? (double)va_arg(va, long double) : va_arg(va, double))
 
 static void stbsp__lead_sign(stbsp__uint32 fl, char *sign)
 {
@@ -444,6 +457,11 @@ STBSP__PUBLICDEF int STB_SPRINTF_DECORATE(vsprintfcb)(STBSP_SPRINTFCB *callback,
       // get the field width
       if (f[0] == '*') {
          fw = va_arg(va, stbsp__uint32);
+         // a negative width is a '-' flag and a positive width, like in C
+         if (fw < 0) {
+            fl |= STBSP__LEFTJUST;
+            fw = (fw < -0x7fffffff) ? 0x7fffffff : -fw;
+         }
          ++f;
       } else {
          while ((f[0] >= '0') && (f[0] <= '9')) {
@@ -456,6 +474,9 @@ STBSP__PUBLICDEF int STB_SPRINTF_DECORATE(vsprintfcb)(STBSP_SPRINTFCB *callback,
          ++f;
          if (f[0] == '*') {
             pr = va_arg(va, stbsp__uint32);
+            // a negative precision is the same as none, like in C
+            if (pr < 0)
+               pr = -1;
             ++f;
          } else {
             pr = 0;
@@ -472,8 +493,10 @@ STBSP__PUBLICDEF int STB_SPRINTF_DECORATE(vsprintfcb)(STBSP_SPRINTFCB *callback,
       case 'h':
          fl |= STBSP__HALFWIDTH;
          ++f;
-         if (f[0] == 'h')
-            ++f;  // QUARTERWIDTH
+         if (f[0] == 'h') {
+            fl |= STBSP__QUARTERWIDTH;
+            ++f;
+         }
          break;
       // are we 64-bit (unix style)
       case 'l':
@@ -484,9 +507,9 @@ STBSP__PUBLICDEF int STB_SPRINTF_DECORATE(vsprintfcb)(STBSP_SPRINTFCB *callback,
             ++f;
          }
          break;
-      // are we 64-bit on intmax? (c99)
+      // intmax_t is 64-bit everywhere, even where size_t isn't (c99)
       case 'j':
-         fl |= (sizeof(size_t) == 8) ? STBSP__INTMAX : 0;
+         fl |= STBSP__INTMAX;
          ++f;
          break;
       // are we 64-bit on size_t or ptrdiff_t? (c99)
@@ -510,6 +533,11 @@ STBSP__PUBLICDEF int STB_SPRINTF_DECORATE(vsprintfcb)(STBSP_SPRINTFCB *callback,
             ++f;
          }
          break;
+      // long double, which is printed at double precision (c89)
+      case 'L':
+         fl |= STBSP__LONGDOUBLE;
+         ++f;
+         break;
       default: break;
       }
 
@@ -529,6 +557,21 @@ STBSP__PUBLICDEF int STB_SPRINTF_DECORATE(vsprintfcb)(STBSP_SPRINTFCB *callback,
          stbsp__int32 dp;
          char const *sn;
 
+#ifdef STB_SPRINTF_LENGTH_OF
+      case 'S':
+         // a string whose length is known, see STB_SPRINTF_LENGTH_OF
+         s = va_arg(va, char *);
+         // the rest of the %s path counts in int, so longer strings are
+         // clamped rather than wrapped
+         if (STB_SPRINTF_LENGTH_OF(s) > 0x7fffffff)
+            l = 0x7fffffff;
+         else
+            l = (stbsp__uint32)STB_SPRINTF_LENGTH_OF(s);
+         if (s == 0)
+            s = (char *)"";
+         goto lknown;
+#endif
+
       case 's':
          // get the string
          s = va_arg(va, char *);
@@ -562,6 +605,9 @@ STBSP__PUBLICDEF int STB_SPRINTF_DECORATE(vsprintfcb)(STBSP_SPRINTFCB *callback,
       ld:
 
          l = (stbsp__uint32)(sn - s);
+#ifdef STB_SPRINTF_LENGTH_OF
+      lknown:
+#endif
          // clamp to precision
          if (l > (stbsp__uint32)pr)
             l = pr;
@@ -587,8 +633,16 @@ STBSP__PUBLICDEF int STB_SPRINTF_DECORATE(vsprintfcb)(STBSP_SPRINTFCB *callback,
 
       case 'n': // weird write-bytes specifier
       {
-         int *d = va_arg(va, int *);
-         *d = tlen + (int)(bf - buf);
+         // written through a pointer of the size the length modifier says
+         stbsp__int32 d = tlen + (int)(bf - buf);
+         if (fl & STBSP__QUARTERWIDTH)
+            *va_arg(va, signed char *) = (signed char)d;
+         else if (fl & STBSP__HALFWIDTH)
+            *va_arg(va, short *) = (short)d;
+         else if (fl & STBSP__INTMAX)
+            *va_arg(va, stbsp__int64 *) = d;
+         else
+            *va_arg(va, int *) = d;
       } break;
 
 #ifdef STB_SPRINTF_NOFLOAT
@@ -599,7 +653,7 @@ STBSP__PUBLICDEF int STB_SPRINTF_DECORATE(vsprintfcb)(STBSP_SPRINTFCB *callback,
       case 'E':              // float
       case 'e':              // float
       case 'f':              // float
-         va_arg(va, double); // eat it
+         (void)STBSP__FLOATARG(); // eat it
          s = (char *)"No float";
          l = 8;
          lead[0] = 0;
@@ -612,7 +666,7 @@ STBSP__PUBLICDEF int STB_SPRINTF_DECORATE(vsprintfcb)(STBSP_SPRINTFCB *callback,
       case 'A': // hex float
       case 'a': // hex float
          h = (f[0] == 'A') ? hexu : hex;
-         fv = va_arg(va, double);
+         fv = STBSP__FLOATARG();
          if (pr == -1)
             pr = 6; // default is 6
          // read the double into a string
@@ -684,7 +738,7 @@ STBSP__PUBLICDEF int STB_SPRINTF_DECORATE(vsprintfcb)(STBSP_SPRINTFCB *callback,
       case 'G': // float
       case 'g': // float
          h = (f[0] == 'G') ? hexu : hex;
-         fv = va_arg(va, double);
+         fv = STBSP__FLOATARG();
          if (pr == -1)
             pr = 6;
          else if (pr == 0)
@@ -721,7 +775,7 @@ STBSP__PUBLICDEF int STB_SPRINTF_DECORATE(vsprintfcb)(STBSP_SPRINTFCB *callback,
       case 'E': // float
       case 'e': // float
          h = (f[0] == 'E') ? hexu : hex;
-         fv = va_arg(va, double);
+         fv = STBSP__FLOATARG();
          if (pr == -1)
             pr = 6; // default is 6
          // read the double into a string
@@ -776,7 +830,7 @@ STBSP__PUBLICDEF int STB_SPRINTF_DECORATE(vsprintfcb)(STBSP_SPRINTFCB *callback,
          goto flt_lead;
 
       case 'f': // float
-         fv = va_arg(va, double);
+         fv = STBSP__FLOATARG();
       doafloat:
          // do kilos
          if (fl & STBSP__METRIC_SUFFIX) {
@@ -1338,6 +1392,9 @@ done:
 #undef STBSP__NEGATIVE
 #undef STBSP__METRIC_SUFFIX
 #undef STBSP__NUMSZ
+#undef STBSP__QUARTERWIDTH
+#undef STBSP__LONGDOUBLE
+#undef STBSP__FLOATARG
 #undef stbsp__chk_cb_bufL
 #undef stbsp__chk_cb_buf
 #undef stbsp__flush_cb